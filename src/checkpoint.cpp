@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "checkpoint.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static constexpr uint32_t MAGIC = 0x4b435445; // "ETCK"
+static constexpr uint32_t VERSION = 1;
+/// more zones than this is a damaged file
+static constexpr uint32_t MAX_ZONES = 4096;
+
+struct Header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t zones;
+    uint32_t checksum;
+    int64_t time;
+};
+
+static_assert(sizeof(Header) == 24, "no padding in the file header");
+static_assert(sizeof(ZoneController::Snapshot) == 48, "no padding in a zone record");
+
+/// FNV-1a
+static uint32_t checksum(const void* data, size_t size, uint32_t hash = 2166136261u)
+{
+    const auto bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+static uint32_t checksum(const Header& header, const std::vector<ZoneController::Snapshot>& zones)
+{
+    auto h = header;
+    h.checksum = 0;
+    return checksum(zones.data(), zones.size() * sizeof(zones[0]),
+                    checksum(&h, sizeof(h)));
+}
+
+static int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+Checkpoint::Checkpoint(std::string path)
+    : m_path(std::move(path))
+{
+}
+
+bool Checkpoint::load()
+{
+    m_valid = false;
+    if (m_path.empty())
+        return false;
+
+    const int fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    Header header{};
+    std::vector<ZoneController::Snapshot> zones;
+    auto ok = ::read(fd, &header, sizeof(header)) == sizeof(header) &&
+              header.magic == MAGIC && header.version == VERSION &&
+              header.zones && header.zones <= MAX_ZONES;
+    if (ok)
+    {
+        zones.resize(header.zones);
+        const auto size = static_cast<ssize_t>(zones.size() * sizeof(zones[0]));
+        ok = ::read(fd, zones.data(), size) == size &&
+             checksum(header, zones) == header.checksum;
+    }
+    ::close(fd);
+
+    if (!ok)
+        return false;
+
+    m_zones = std::move(zones);
+    m_time = header.time;
+    m_valid = true;
+    return true;
+}
+
+std::chrono::milliseconds Checkpoint::age() const
+{
+    // a clock set backwards makes the checkpoint new, not from the future
+    return std::chrono::milliseconds(std::max<int64_t>(now_ms() - m_time, 0));
+}
+
+bool Checkpoint::save(const ZoneController& zones)
+{
+    if (m_path.empty())
+        return false;
+
+    m_zones = zones.snapshot();
+    m_time = now_ms();
+
+    Header header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.zones = static_cast<uint32_t>(m_zones.size());
+    header.time = m_time;
+    header.checksum = checksum(header, m_zones);
+
+    std::vector<uint8_t> buffer(sizeof(header) + m_zones.size() * sizeof(m_zones[0]));
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    std::memcpy(buffer.data() + sizeof(header), m_zones.data(), buffer.size() - sizeof(header));
+
+    const auto tmp = m_path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+
+    // the data is on disk before the rename can make it the checkpoint
+    const auto ok = ::write(fd, buffer.data(), buffer.size()) == static_cast<ssize_t>(buffer.size()) &&
+                    ::fsync(fd) == 0;
+    ::close(fd);
+
+    if (!ok || std::rename(tmp.c_str(), m_path.c_str()) != 0)
+    {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+
+    sync_dir();
+    m_valid = true;
+    return true;
+}
+
+void Checkpoint::remove()
+{
+    m_valid = false;
+    if (m_path.empty())
+        return;
+
+    if (::unlink(m_path.c_str()) == 0)
+        sync_dir();
+}
+
+void Checkpoint::sync_dir() const
+{
+    const auto slash = m_path.rfind('/');
+    const auto dir = slash == std::string::npos ? std::string(".") :
+                     slash == 0 ? std::string("/") : m_path.substr(0, slash);
+
+    const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
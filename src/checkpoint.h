@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "zones.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Control state of every zone kept in a small file, so a restarted
+ * application resumes where the last one left off.
+ *
+ * The file is a fixed header and one ZoneController::Snapshot per zone,
+ * under a checksum.  Saving writes and syncs a temporary file, renames it
+ * over the old one and syncs the directory, so a crash or power loss at
+ * any point leaves either checkpoint intact.
+ */
+class Checkpoint
+{
+public:
+
+    /// An empty path disables the checkpoint.
+    explicit Checkpoint(std::string path = {});
+
+    inline const std::string& path() const { return m_path; }
+
+    /// Read the file.  False if missing, damaged or from another version.
+    bool load();
+
+    /// True once loaded or saved.
+    inline bool valid() const { return m_valid; }
+
+    inline const std::vector<ZoneController::Snapshot>& zones() const { return m_zones; }
+
+    /// Wall clock time since the state was saved.
+    std::chrono::milliseconds age() const;
+
+    /// Save the state of every zone.
+    bool save(const ZoneController& zones);
+
+    /// Delete the file, so the next run starts afresh.
+    void remove();
+
+protected:
+
+    /// Make a rename or unlink in the directory of the file durable.
+    void sync_dir() const;
+
+    std::string m_path;
+    std::vector<ZoneController::Snapshot> m_zones;
+    /// when saved, milliseconds since the Unix epoch
+    int64_t m_time{0};
+    bool m_valid{false};
+};
+
+#endif
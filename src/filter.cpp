@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "filter.h"
+#include "sampler.h"
+#include <algorithm>
+#include <cmath>
+
+SampleFilter::SampleFilter(const Config& config)
+    : m_config(config)
+{
+    m_config.median = std::max<size_t>(1, std::min(m_config.median, MAX_MEDIAN));
+    m_config.alpha = std::max(0., std::min(m_config.alpha, 1.));
+}
+
+SampleFilter::result SampleFilter::process(Sample& sample)
+{
+    ++m_stats.in;
+
+    if (sample.q != Sample::quality::good)
+    {
+        // a failed read now and then is not worth giving up the temperature
+        if (++m_errors < m_config.errors)
+        {
+            ++m_stats.held;
+            return result::hold;
+        }
+        ++m_stats.read_faults;
+        return fault(sample);
+    }
+    m_errors = 0;
+
+    if (!(sample.value >= m_config.min && sample.value <= m_config.max))
+    {
+        ++m_stats.range_faults;
+        return fault(sample);
+    }
+
+    if (!m_have_raw || !(sample.value == m_last_raw))
+    {
+        m_last_raw = sample.value;
+        m_last_change = sample.time;
+        m_have_raw = true;
+    }
+    else if (m_config.stuck.count() && sample.time - m_last_change >= m_config.stuck)
+    {
+        ++m_stats.stuck_faults;
+        return fault(sample);
+    }
+
+    auto value = median(sample.value);
+
+    if (m_have_ema)
+        value = m_ema + m_config.alpha * (value - m_ema);
+    m_ema = value;
+    m_have_ema = true;
+
+    if (m_have_passed && std::fabs(value - m_passed) < m_config.deadband)
+    {
+        ++m_stats.held;
+        return result::hold;
+    }
+
+    m_passed = value;
+    m_have_passed = true;
+    sample.value = value;
+    ++m_stats.passed;
+    return result::pass;
+}
+
+SampleFilter::result SampleFilter::fault(Sample& sample)
+{
+    sample.q = Sample::quality::fault;
+    // whatever comes next is news, however close to the last value passed
+    m_have_passed = false;
+    return result::fault;
+}
+
+double SampleFilter::median(double value)
+{
+    m_window[m_window_pos] = value;
+    m_window_pos = (m_window_pos + 1) % m_config.median;
+    if (m_window_count < m_config.median)
+        ++m_window_count;
+
+    if (m_window_count == 1)
+        return value;
+
+    std::array<double, MAX_MEDIAN> sorted;
+    std::copy_n(m_window.begin(), m_window_count, sorted.begin());
+    const auto mid = sorted.begin() + m_window_count / 2;
+    std::nth_element(sorted.begin(), mid, sorted.begin() + m_window_count);
+    return *mid;
+}
+
+void SampleFilter::reset()
+{
+    m_window_pos = 0;
+    m_window_count = 0;
+    m_have_ema = false;
+    m_have_raw = false;
+    m_have_passed = false;
+    m_errors = 0;
+}
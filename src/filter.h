@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+struct Sample;
+
+/**
+ * Streaming filter between the sensor read and Logic.
+ *
+ * Stages, in order: range check, stuck sensor detection, median-of-N spike
+ * rejection, exponential moving average, and a deadband against the last
+ * value passed on.  All state lives in fixed size buffers.
+ */
+class SampleFilter
+{
+public:
+
+    static constexpr size_t MAX_MEDIAN = 9;
+
+    struct Config
+    {
+        /// valid range in Celsius, anything outside is a fault
+        double min{-40.};
+        double max{85.};
+        /**
+         * An unchanged raw value for this long is a fault, 0 disables.  Off
+         * by default, since a coarsely quantised sensor in a steady room
+         * reads exactly the same for hours.
+         */
+        std::chrono::seconds stuck{0};
+        /// failed reads in a row that make a fault, fewer are held
+        unsigned errors{3};
+        /// median window, 1 disables
+        size_t median{5};
+        /// EMA weight of the newest value, 1 disables
+        double alpha{0.3};
+        /// minimum change from the last passed value in Celsius, 0 disables
+        double deadband{0.25};
+    };
+
+    enum class result
+    {
+        pass,
+        hold,
+        fault,
+    };
+
+    struct Stats
+    {
+        unsigned long in{0};
+        unsigned long passed{0};
+        unsigned long held{0};
+        unsigned long range_faults{0};
+        unsigned long stuck_faults{0};
+        unsigned long read_faults{0};
+    };
+
+    SampleFilter() = default;
+
+    explicit SampleFilter(const Config& config);
+
+    /**
+     * Filter a sample in place.  Pass and fault results should reach Logic,
+     * a fault meaning the temperature is no longer known.  The first good
+     * sample after a fault always passes.
+     */
+    result process(Sample& sample);
+
+    void reset();
+
+    inline const Config& config() const { return m_config; }
+
+    inline const Stats& stats() const { return m_stats; }
+
+protected:
+
+    result fault(Sample& sample);
+    double median(double value);
+
+    Config m_config;
+    Stats m_stats;
+
+    std::array<double, MAX_MEDIAN> m_window{};
+    size_t m_window_pos{0};
+    size_t m_window_count{0};
+
+    double m_ema{0.};
+    bool m_have_ema{false};
+
+    double m_last_raw{0.};
+    std::chrono::steady_clock::time_point m_last_change;
+    bool m_have_raw{false};
+
+    double m_passed{0.};
+    bool m_have_passed{false};
+
+    /// failed reads in a row
+    unsigned m_errors{0};
+};
+
+#endif
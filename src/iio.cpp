@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "iio.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <egt/app.h>
+#include <egt/asio.hpp>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char IIO_PREFIX[] = "iio:";
+static const char IIO_DEV_DIR[] = "/dev/";
+static const char IIO_SYSFS_DIR[] = "/sys/bus/iio/devices/";
+
+static bool read_attr(const fs::path& path, std::string& value)
+{
+    std::ifstream in(path);
+    return static_cast<bool>(std::getline(in, value));
+}
+
+static void write_attr(const fs::path& path, const char* value)
+{
+    std::ofstream out(path);
+    out << value;
+}
+
+bool IioScan::parse_type(const std::string& type, Element& element)
+{
+    char endian = 0;
+    char sign = 0;
+    unsigned bits = 0;
+    unsigned storage = 0;
+    unsigned repeat = 1;
+    unsigned shift = 0;
+
+    if (std::sscanf(type.c_str(), "%ce:%c%u/%uX%u>>%u",
+                    &endian, &sign, &bits, &storage, &repeat, &shift) != 6)
+    {
+        repeat = 1;
+        if (std::sscanf(type.c_str(), "%ce:%c%u/%u>>%u",
+                        &endian, &sign, &bits, &storage, &shift) != 5)
+            return false;
+    }
+
+    if ((endian != 'b' && endian != 'l') ||
+        (sign != 's' && sign != 'u') ||
+        !bits || bits > storage || !repeat ||
+        (storage != 8 && storage != 16 && storage != 32 && storage != 64))
+        return false;
+
+    element.big_endian = endian == 'b';
+    element.is_signed = sign == 's';
+    element.bits = bits;
+    element.storage = storage;
+    element.repeat = repeat;
+    element.shift = shift;
+    return true;
+}
+
+bool IioScan::open(const std::string& sysfs)
+{
+    m_elements.clear();
+    m_temp = -1;
+    m_record_size = 0;
+    m_scale = 1.;
+    m_offset = 0.;
+
+    const fs::path dir = fs::path(sysfs) / "scan_elements";
+    std::error_code ec;
+    if (!fs::is_directory(dir, ec))
+        return false;
+
+    // make sure the first temperature channel is part of the scan
+    for (const auto& entry : fs::directory_iterator(dir, ec))
+    {
+        const auto file = entry.path().filename().string();
+        if (file.compare(0, 7, "in_temp") == 0 &&
+            file.size() > 3 && file.compare(file.size() - 3, 3, "_en") == 0)
+        {
+            write_attr(entry.path(), "1");
+            break;
+        }
+    }
+
+    for (const auto& entry : fs::directory_iterator(dir, ec))
+    {
+        const auto file = entry.path().filename().string();
+        if (file.size() <= 3 || file.compare(file.size() - 3, 3, "_en") != 0)
+            continue;
+
+        std::string value;
+        if (!read_attr(entry.path(), value) || value != "1")
+            continue;
+
+        Element element;
+        element.name = file.substr(0, file.size() - 3);
+
+        std::string index;
+        std::string type;
+        if (!read_attr(dir / (element.name + "_index"), index) ||
+            !read_attr(dir / (element.name + "_type"), type) ||
+            !parse_type(type, element))
+            return false;
+
+        element.index = std::stoi(index);
+        m_elements.push_back(element);
+    }
+
+    std::sort(m_elements.begin(), m_elements.end(),
+              [](const Element & a, const Element & b) { return a.index < b.index; });
+
+    // each element is aligned to its own storage size, the record to the largest
+    size_t offset = 0;
+    size_t align = 1;
+    for (size_t i = 0; i < m_elements.size(); ++i)
+    {
+        auto& element = m_elements[i];
+        const size_t bytes = element.storage / 8;
+        offset = (offset + bytes - 1) / bytes * bytes;
+        element.offset = offset;
+        offset += bytes * element.repeat;
+        align = std::max(align, bytes);
+
+        if (m_temp < 0 && element.name.compare(0, 7, "in_temp") == 0)
+            m_temp = static_cast<int>(i);
+    }
+    m_record_size = (offset + align - 1) / align * align;
+
+    if (m_temp >= 0)
+    {
+        // scale and offset bring the raw value to millidegrees Celsius
+        const auto& name = m_elements[m_temp].name;
+        std::string value;
+        if (read_attr(fs::path(sysfs) / (name + "_scale"), value) ||
+            read_attr(fs::path(sysfs) / "in_temp_scale", value))
+            m_scale = std::stod(value);
+        if (read_attr(fs::path(sysfs) / (name + "_offset"), value) ||
+            read_attr(fs::path(sysfs) / "in_temp_offset", value))
+            m_offset = std::stod(value);
+    }
+
+    return valid();
+}
+
+double IioScan::decode(const uint8_t* record) const
+{
+    const auto& element = m_elements[m_temp];
+    const auto bytes = element.storage / 8;
+    const auto data = record + element.offset;
+
+    uint64_t raw = 0;
+    for (unsigned i = 0; i < bytes; ++i)
+    {
+        const auto b = element.big_endian ? data[i] : data[bytes - 1 - i];
+        raw = (raw << 8) | b;
+    }
+
+    raw >>= element.shift;
+    if (element.bits < 64)
+        raw &= (uint64_t(1) << element.bits) - 1;
+
+    int64_t value = static_cast<int64_t>(raw);
+    if (element.is_signed && element.bits < 64 && (raw >> (element.bits - 1)) & 1)
+        value -= int64_t(1) << element.bits;
+
+    return (value + m_offset) * m_scale / 1000.;
+}
+
+struct IioSensor::watch_impl
+{
+    explicit watch_impl(asio::io_context& io)
+        : io(io),
+          input(io)
+    {}
+
+    asio::io_context& io;
+    asio::posix::stream_descriptor input;
+    bool pollable{false};
+};
+
+IioSensor::IioSensor()
+    : IioSensor(egt::Application::instance().event().io())
+{
+}
+
+IioSensor::IioSensor(asio::io_context& io)
+    : m_watch(std::make_unique<watch_impl>(io))
+{
+}
+
+bool IioSensor::open(const std::string& name)
+{
+    if (!is_iio_sensor(name))
+        return false;
+
+    return open(IIO_DEV_DIR + name, IIO_SYSFS_DIR + name);
+}
+
+bool IioSensor::open(const std::string& device, const std::string& sysfs)
+{
+    close();
+
+    if (!m_scan.open(sysfs) || m_scan.record_size() > m_buffer.size())
+        return false;
+
+    m_sysfs = sysfs;
+    write_attr(fs::path(sysfs) / "buffer" / "enable", "1");
+
+    m_fd = ::open(device.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (m_fd < 0)
+        return false;
+
+    // regular files are always readable, so they are read a block at a time
+    // instead; epoll refuses them, which asio hides by never completing a wait
+    struct stat st{};
+    m_watch->pollable = false;
+    if (::fstat(m_fd, &st) == 0 && !S_ISREG(st.st_mode))
+    {
+        asio::error_code ec;
+        m_watch->input.assign(m_fd, ec);
+        m_watch->pollable = !ec;
+    }
+
+    m_pending = 0;
+    m_filter.reset();
+    arm();
+    return true;
+}
+
+void IioSensor::close()
+{
+    if (m_fd < 0)
+        return;
+
+    if (m_watch->pollable)
+    {
+        m_watch->input.cancel();
+        m_watch->input.release();
+        m_watch->pollable = false;
+    }
+
+    ::close(m_fd);
+    m_fd = -1;
+
+    write_attr(fs::path(m_sysfs) / "buffer" / "enable", "0");
+}
+
+void IioSensor::filter(const SampleFilter::Config& config)
+{
+    m_filter = SampleFilter(config);
+}
+
+void IioSensor::on_sample(sample_callback_t callback)
+{
+    m_callback = std::move(callback);
+}
+
+void IioSensor::arm()
+{
+    if (m_watch->pollable)
+    {
+        m_watch->input.async_wait(asio::posix::stream_descriptor::wait_read,
+                                  [this](const asio::error_code & error)
+        {
+            if (error)
+                return;
+
+            read_block();
+        });
+    }
+    else
+    {
+        asio::post(m_watch->io, [this]()
+        {
+            if (is_open())
+                read_block();
+        });
+    }
+}
+
+void IioSensor::read_block()
+{
+    const auto n = ::read(m_fd, m_buffer.data() + m_pending, m_buffer.size() - m_pending);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+        arm();
+        return;
+    }
+
+    if (n <= 0)
+    {
+        // end of a FIFO or file, or the device went away, so the
+        // temperature is no longer known
+        close();
+        if (m_callback)
+        {
+            Sample fault;
+            fault.time = std::chrono::steady_clock::now();
+            fault.q = Sample::quality::fault;
+            m_callback(fault);
+        }
+        return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto total = m_pending + static_cast<size_t>(n);
+    const auto size = m_scan.record_size();
+
+    Sample latest;
+    bool have = false;
+    size_t pos = 0;
+    for (; pos + size <= total; pos += size)
+    {
+        Sample sample;
+        sample.value = m_scan.decode(m_buffer.data() + pos);
+        sample.time = now;
+        sample.q = Sample::quality::good;
+        if (m_filter.process(sample) != SampleFilter::result::hold)
+        {
+            latest = sample;
+            have = true;
+        }
+    }
+
+    m_pending = total - pos;
+    if (m_pending)
+        std::memmove(m_buffer.data(), m_buffer.data() + pos, m_pending);
+
+    if (have && m_callback)
+        m_callback(latest);
+
+    arm();
+}
+
+IioSensor::~IioSensor()
+{
+    close();
+}
+
+bool is_iio_sensor(const std::string& name)
+{
+    return name.compare(0, sizeof(IIO_PREFIX) - 1, IIO_PREFIX) == 0;
+}
+
+std::vector<std::string> enumerate_iio_sensors()
+{
+    std::vector<std::string> res;
+
+    std::error_code ec;
+    if (!fs::is_directory(IIO_SYSFS_DIR, ec))
+        return res;
+
+    for (const auto& dev : fs::directory_iterator(IIO_SYSFS_DIR, ec))
+    {
+        const auto scan = dev.path() / "scan_elements";
+        if (!fs::is_directory(scan, ec))
+            continue;
+
+        for (const auto& entry : fs::directory_iterator(scan, ec))
+        {
+            if (entry.path().filename().string().compare(0, 7, "in_temp") == 0)
+            {
+                res.push_back(dev.path().filename().string());
+                break;
+            }
+        }
+    }
+
+    std::sort(res.begin(), res.end());
+    return res;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef IIO_H
+#define IIO_H
+
+#include "filter.h"
+#include "sampler.h"
+#include <array>
+#include <cstdint>
+#include <egt/asio.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Decoder for the IIO buffered interface scan records.
+ *
+ * The scan_elements type descriptors are parsed once when opened. The
+ * enabled temperature channel is then decoded straight out of each record.
+ */
+class IioScan
+{
+public:
+
+    struct Element
+    {
+        std::string name;
+        int index{0};
+        bool big_endian{false};
+        bool is_signed{false};
+        unsigned bits{0};
+        unsigned storage{0};
+        unsigned repeat{1};
+        unsigned shift{0};
+        size_t offset{0};
+    };
+
+    /// Parse a descriptor such as "le:s16/16>>0" or "be:u12/16X2>>4".
+    static bool parse_type(const std::string& type, Element& element);
+
+    /// Read the scan_elements of an IIO device directory.
+    bool open(const std::string& sysfs);
+
+    /// Decode the temperature of one record in Celsius.
+    double decode(const uint8_t* record) const;
+
+    inline size_t record_size() const { return m_record_size; }
+
+    inline bool valid() const { return m_temp >= 0 && m_record_size; }
+
+    inline const std::vector<Element>& elements() const { return m_elements; }
+
+protected:
+
+    std::vector<Element> m_elements;
+    int m_temp{-1};
+    size_t m_record_size{0};
+    double m_scale{1.};
+    double m_offset{0.};
+};
+
+/**
+ * IIO temperature sensor read through the buffered character device.
+ *
+ * The device fd is watched by the EGT event loop, so samples arrive as the
+ * device produces them with no periodic timer. Reads are non-blocking and
+ * handle whole blocks of records at a time. The device may also be a FIFO or
+ * a regular file holding scan records.
+ *
+ * The end of a FIFO or file, a read error or a removed device closes the
+ * sensor and is reported as a Sample::quality::fault.
+ */
+class IioSensor
+{
+public:
+
+    using sample_callback_t = std::function<void(const Sample&)>;
+
+    /// Watch the device from the EGT event loop.
+    IioSensor();
+
+    /// Watch the device from another io_context, for example in tests.
+    explicit IioSensor(asio::io_context& io);
+
+    IioSensor(const IioSensor&) = delete;
+    IioSensor& operator=(const IioSensor&) = delete;
+
+    /// Open "iio:deviceN" from /dev and /sys/bus/iio/devices.
+    bool open(const std::string& name);
+
+    /// Open an explicit device node and sysfs directory.
+    bool open(const std::string& device, const std::string& sysfs);
+
+    void close();
+
+    inline bool is_open() const { return m_fd >= 0; }
+
+    void filter(const SampleFilter::Config& config);
+
+    /// Called with the last sample passed by the filter in each block, and
+    /// with a fault when the device closes on its own.
+    void on_sample(sample_callback_t callback);
+
+    virtual ~IioSensor();
+
+protected:
+
+    void arm();
+    void read_block();
+
+    IioScan m_scan;
+    SampleFilter m_filter;
+    std::string m_sysfs;
+    int m_fd{-1};
+    std::array<uint8_t, 4096> m_buffer{};
+    size_t m_pending{0};
+
+    struct watch_impl;
+    std::unique_ptr<watch_impl> m_watch;
+    sample_callback_t m_callback;
+};
+
+/// True if a sensor name refers to an IIO device.
+bool is_iio_sensor(const std::string& name);
+
+/// Names of IIO devices with a temperature scan element.
+std::vector<std::string> enumerate_iio_sensors();
+
+#endif
@@ -5,16 +5,103 @@
  */
 #include "logic.h"
 #include "settings.h"
+#include <algorithm>
 #include <chrono>
-#include <egt/detail/math.h>
+#include <ctime>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 
 using namespace egt;
 using namespace std;
 
-Logic::Logic()
+/// Older than this and the state in a checkpoint no longer holds.
+static constexpr auto CHECKPOINT_MAX_AGE = std::chrono::minutes(5);
+
+Logic::Logic(Checkpoint* checkpoint)
+    : m_zones(1, Temperature::from_celsius(settings().real<setting::target_temp>())),
+      m_checkpoint(checkpoint)
 {
-    m_target = std::stof(settings().get("target_temp"));
+    load_control();
+
+    m_outside = Temperature::from_celsius(settings().real<setting::outside_temp>());
+    m_model.load(settings().get("thermal_model"));
+    load_rules();
+
+    m_zones.set_mode(0, settings().choice<setting::mode, mode>());
+    m_zones.set_fan_mode(0, settings().choice<setting::fan, fanmode>());
+
+    // follow the settings pages, deciding again only on a real change
+    settings().on_change("mode").on_event([this](const std::string&, const std::string&)
+    {
+        set_mode(settings().choice<setting::mode, mode>());
+    });
+    settings().on_change("fan").on_event([this](const std::string&, const std::string&)
+    {
+        set_fan_mode(settings().choice<setting::fan, fanmode>());
+    });
+    settings().on_change("degrees").on_event([this](const std::string&, const std::string&)
+    {
+        refresh();
+    });
+    for (const auto key : {"deadband", "heat_min_on", "heat_min_off",
+                           "cool_min_on", "cool_min_off", "fan_overrun"
+                          })
+    {
+        settings().on_change(key).on_event([this](const std::string&, const std::string&)
+        {
+            load_control();
+        });
+    }
+    for (const auto key : {"rules", "rules_file"})
+    {
+        settings().on_change(key).on_event([this](const std::string&, const std::string&)
+        {
+            load_rules();
+        });
+    }
+
+    m_zones.on_change([this](const std::vector<ZoneController::Change>& changes)
+    {
+        // the timers only move with the status and fan; a new reading, a
+        // target dragged on the slider or what the driver confirmed is not
+        // worth a synchronous write, the next save carries the target along
+        static constexpr unsigned saved = dirty::mode | dirty::fan | dirty::status;
+        if (m_checkpoint &&
+            std::any_of(changes.begin(), changes.end(),
+                        [](const ZoneController::Change & c) { return c.fields & saved; }))
+            m_checkpoint->save(m_zones);
+
+        for (const auto& change : changes)
+        {
+            if (change.zone != 0)
+                continue;
+
+            learn(change.fields);
+
+            if (change.fields & dirty::fan)
+                cout << "fan: " << current_fan_status() << endl;
+
+            if (change.fields & dirty::status)
+                cout << "status: " << status_str(current_status()) << endl;
+
+            on_change.invoke(change.fields);
+        }
+    });
+
+    m_zones.on_deadline_change([this]()
+    {
+        on_deadline_change.invoke();
+    });
+
+    // carry on from the last run, deciding straight away on its last sample
+    if (m_checkpoint && m_checkpoint->valid() &&
+        m_checkpoint->age() <= CHECKPOINT_MAX_AGE)
+    {
+        cout << "resuming from checkpoint " << m_checkpoint->age().count() << "ms old" << endl;
+        m_zones.restore(m_checkpoint->zones(), m_checkpoint->age());
+        m_zones.process();
+    }
 }
 
 std::string Logic::status_str(status s)
@@ -32,114 +119,129 @@ std::string Logic::status_str(status s)
     return {};
 }
 
-void Logic::change_target(float value)
+void Logic::learn(unsigned fields)
 {
-    if (egt::detail::change_if_diff<>(m_target, value))
-    {
-        Settings::AutoTransaction tx(settings());
+    const auto hours = std::chrono::duration<double, std::ratio<3600>>(
+                           m_zones.now().time_since_epoch()).count();
 
-        if (settings().get("sql_logs") == "on")
-            settings().set("target_temp", std::to_string(m_target));
+    // the sample that caused a status change belongs to the old status
+    if ((fields & dirty::current) && current_valid())
+        m_model.sample(m_segment, hours, current().celsius(), m_outside.celsius());
 
-        process();
-        on_logic_change.invoke();
+    if (fields & dirty::status)
+    {
+        ThermalModel::transition(m_segment, current_status(), hours);
+        settings().set("thermal_model", m_model.save());
     }
 }
 
-void Logic::change_current(float value)
+void Logic::load_control()
 {
-    if (egt::detail::change_if_diff<>(m_current, value))
-    {
-        Settings::AutoTransaction tx(settings());
-
-        process();
-        on_temperature_change.invoke();
-    }
+    Control control;
+    control.deadband = Temperature::from_celsius(settings().real<setting::deadband>());
+    control.heat.min_on = std::chrono::seconds(settings().integer<setting::heat_min_on>());
+    control.heat.min_off = std::chrono::seconds(settings().integer<setting::heat_min_off>());
+    control.cool.min_on = std::chrono::seconds(settings().integer<setting::cool_min_on>());
+    control.cool.min_off = std::chrono::seconds(settings().integer<setting::cool_min_off>());
+    control.fan_overrun = std::chrono::seconds(settings().integer<setting::fan_overrun>());
+    m_zones.control(control);
+
+    // nothing to decide before the first sample
+    if (sampled())
+        m_zones.process();
 }
 
-void Logic::process()
+bool Logic::load_rules()
 {
-    auto current = std::round(m_current);
-    auto target = std::round(m_target);
-
-    if (settings().get("degrees") == "f")
+    auto source = settings().get("rules");
+    const auto file = settings().get("rules_file");
+    if (!file.empty())
     {
-        current = std::round(CtoF(m_current));
-        target = std::round(CtoF(m_target));
+        std::ifstream in(file);
+        if (!in)
+        {
+            cerr << "failed to open " << file << endl;
+            return false;
+        }
+
+        std::stringstream ss;
+        ss << in.rdbuf();
+        source = ss.str();
     }
 
-    // change status based on mode and current temps
-    switch (m_mode)
-    {
-    case mode::automatic:
-        if (current > target)
-            change_status(status::cooling, true);
-        else if (current < target)
-            change_status(status::heating, true);
-        else
-            change_status(status::off, m_fan_mode == fanmode::on);
-        break;
-    case mode::cooling:
-        if (current > target)
-            change_status(status::cooling, true);
-        else
-            change_status(status::off, m_fan_mode == fanmode::on);
-        break;
-    case mode::heating:
-        if (current < target)
-            change_status(status::heating, true);
-        else
-            change_status(status::off, m_fan_mode == fanmode::on);
-        break;
-    case mode::off:
-        change_status(status::off, m_fan_mode == fanmode::on);
-        break;
-    };
-}
-
-void Logic::set_mode(mode m)
-{
-    if (egt::detail::change_if_diff<>(m_mode, m))
+    if (!m_rules.compile(source))
     {
-        process();
-        on_logic_change.invoke();
+        cerr << "rules: " << m_rules.error() << endl;
+        return false;
     }
-}
 
-void Logic::set_fan_mode(fanmode m)
-{
-    if (egt::detail::change_if_diff<>(m_fan_mode, m))
+    if (m_rules.empty())
     {
-        process();
-        on_logic_change.invoke();
+        m_zones.policies(nullptr);
+        for (size_t zone = 0; zone < m_zones.size(); ++zone)
+            m_zones.set_policy(zone, 0);
+    }
+    else
+    {
+        m_zones.policies([this](time_point now)
+        {
+            return apply_rules(now);
+        });
     }
+
+    // nothing to decide before the first sample
+    if (sampled())
+        process();
+    return true;
 }
 
-void Logic::change_status(status s, bool fan)
+Logic::time_point Logic::apply_rules(time_point now)
 {
-    auto f1 = egt::detail::change_if_diff<>(m_fan_status, fan);
-    if (f1)
-    {
-        cout << "fan: " << m_fan_status << endl;
+    Rules::Inputs inputs{};
+    inputs[Rules::input::outside] = m_outside.celsius();
 
-        // set fan output to m_fan_status
+    time_point next;
+    if (m_rules.uses() & Rules::TIME_INPUTS)
+    {
+        const auto t = std::time(nullptr);
+        std::tm tm{};
+        localtime_r(&t, &tm);
+        inputs[Rules::input::minute] = tm.tm_min;
+        inputs[Rules::input::hour] = tm.tm_hour;
+        inputs[Rules::input::dow] = tm.tm_wday;
+
+        // the time inputs change next on the minute
+        next = now + std::chrono::seconds(std::max(1, 60 - tm.tm_sec));
     }
 
-    auto s1 = egt::detail::change_if_diff<>(m_status, s);
-    if (s1)
-    {
-        cout << "status: " << status_str(m_status) << endl;
+    m_rules.apply(m_zones, inputs);
+    return next;
+}
 
-        // set cool/heat output to m_status
-    }
+void Logic::confirm_outputs(unsigned levels, time_point time)
+{
+    m_outputs = levels;
+    m_outputs_time = time;
+    m_zones.touch(0, dirty::outputs);
+}
 
-    if (f1 || s1)
+void Logic::change_outside(Temperature value)
+{
+    if (value != m_outside)
     {
-        on_logic_change.invoke();
+        m_outside = value;
+        if (m_rules.uses() & (1u << Rules::input::outside))
+            process();
     }
 }
 
-void Logic::refresh()
+void Logic::change_target(Temperature value)
 {
-    on_logic_change.invoke();
+    if (value != target())
+    {
+        if (settings().flag<setting::sql_logs>())
+            settings().set("target_temp", std::to_string(value.celsius()));
+
+        m_zones.change_target(0, value);
+    }
 }
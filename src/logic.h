@@ -6,94 +6,157 @@
 #ifndef LOGIC_H
 #define LOGIC_H
 
-#include <egt/ui>
+#include "checkpoint.h"
+#include "rules.h"
+#include "temperature.h"
+#include "thermal.h"
+#include "zones.h"
+#include <egt/signal.h>
 #include <string>
 
+/**
+ * The single zone thermostat used by the pages, a view over zone 0 of a
+ * ZoneController.
+ */
 class Logic
 {
 public:
-    enum class mode
-    {
-        off,
-        automatic,
-        cooling,
-        heating,
-    };
+    using mode = ZoneController::mode;
+    using fanmode = ZoneController::fanmode;
+    using status = ZoneController::status;
+    using time_point = ZoneController::time_point;
+    using clock_function = ZoneController::clock_function;
+    using defer_function = ZoneController::defer_function;
+    using Stage = ZoneController::Stage;
+    using Control = ZoneController::Control;
+    using dirty = ZoneController::dirty;
+
+    /**
+     * Invoked with the mask of zone 0 fields that changed.
+     *
+     * Changes are coalesced into at most one invocation per deferral, see
+     * defer().
+     *
+     * @note The application runs this inside a settings transaction, do not
+     * start one on callback.
+     */
+    egt::Signal<unsigned> on_change;
+
+    /// Invoked when deadline() changes.
+    egt::Signal<> on_deadline_change;
+
+    /**
+     * Resume from a recent enough checkpoint, and keep it up to date as
+     * the mode, fan or status changes.  Without one, or with one too old, the mode and fan
+     * mode come from settings and the zone starts idle.
+     */
+    explicit Logic(Checkpoint* checkpoint = nullptr);
+
+    /**
+     * Set how change notifications are deferred, for example by posting to
+     * the event loop. Without one, on_change is invoked at the end of each
+     * call that changed something.
+     */
+    inline void defer(defer_function defer) { m_zones.defer(std::move(defer)); }
+
+    /// Replace the clock used for all control timing, for example in tests.
+    inline void clock(clock_function clock) { m_zones.clock(std::move(clock)); }
+
+    inline void control(const Control& control) { m_zones.control(control); }
+
+    inline const Control& control() const { return m_zones.control(); }
+
+    /**
+     * Time at which process() needs to run again even if nothing changes,
+     * because a hold or the fan overrun expires, in any zone.
+     * time_point() if none.
+     */
+    inline time_point deadline() const { return m_zones.deadline(); }
 
-    enum class fanmode
-    {
-        on,
-        automatic,
-    };
+    static std::string status_str(status s);
 
-    enum class status
-    {
-        off,
-        cooling,
-        heating,
-    };
+    void change_target(Temperature value);
 
+    inline Temperature target() const { return m_zones.target(0); }
 
-    /// @note Do not start a settings transaction on callback, one is already started.
-    egt::Signal<> on_logic_change;
+    inline void change_current(Temperature value) { m_zones.change_current(0, value); }
 
-    egt::Signal<> on_temperature_change;
+    inline Temperature current() const { return m_zones.current(0); }
 
-    Logic();
+    /// The sensor failed, see ZoneController::lose_current().
+    inline void lose_current() { m_zones.lose_current(0); }
 
-    static std::string status_str(status s);
+    /// False before the first sample and after a sensor fault.
+    inline bool current_valid() const { return m_zones.sampled(0); }
 
-    void change_target(float value);
+    /// True once a current temperature has been received.
+    inline bool sampled() const { return m_segment.valid; }
 
-    inline float target() const { return m_target; }
+    inline void process() { m_zones.process(); }
 
-    void change_current(float value);
+    inline mode get_mode() const { return m_zones.get_mode(0); }
 
-    inline float current() const { return m_current; }
+    inline void set_mode(mode m) { m_zones.set_mode(0, m); }
 
-    void process();
+    inline void set_fan_mode(fanmode m) { m_zones.set_fan_mode(0, m); }
 
-    inline mode get_mode() const { return m_mode; }
+    inline status current_status() const { return m_zones.current_status(0); }
 
-    void set_mode(mode m);
+    inline bool current_fan_status() const { return m_zones.current_fan_status(0); }
 
-    void set_fan_mode(fanmode m);
+    /// Notify listeners that the displayed values need to be redrawn.
+    inline void refresh() { m_zones.touch(0, dirty::target | dirty::current); }
 
-    inline status current_status() const { return m_status; }
+    /**
+     * Record output levels confirmed applied by the output driver, as a
+     * mask of 1 << HvacOutputs::output, and when they were.
+     */
+    void confirm_outputs(unsigned levels, time_point time);
 
-    inline bool current_fan_status() const { return m_fan_status; }
+    inline unsigned confirmed_outputs() const { return m_outputs; }
 
-    void refresh();
+    inline time_point confirmed_time() const { return m_outputs_time; }
 
-    virtual ~Logic() = default;
+    inline Temperature outside() const { return m_outside; }
 
-protected:
+    void change_outside(Temperature value);
 
-    void change_status(status s, bool fan);
+    /// Thermal response learned from zone 0, saved on every status change.
+    inline const ThermalModel& model() const { return m_model; }
 
-    float m_current{0.f};
-    float m_target{0.f};
+    inline ThermalModel& model() { return m_model; }
 
-    mode m_mode{mode::automatic};
-    status m_status{status::off};
+    /// Read the deadband and the stage timings from settings.
+    void load_control();
 
-    fanmode m_fan_mode{fanmode::automatic};
-    bool m_fan_status{false};
-};
+    /**
+     * Compile the site rules, from the file named by the rules_file setting
+     * if set, otherwise from the rules setting, and apply them to all zones.
+     * Returns false and keeps the previous rules on error.
+     */
+    bool load_rules();
 
-template<class T>
-constexpr T KtoC(T x) { return x - 273.15; }
+    inline const Rules& rules() const { return m_rules; }
 
-template<class T>
-constexpr T KtoF(T x) { return x * 9.0 / 5.0 - 459.67; }
+    /// All zones, zone 0 being the one this object shows.
+    inline ZoneController& zones() { return m_zones; }
 
-template<class T>
-constexpr T CtoK(T x) { return x + 273.15; }
+    virtual ~Logic() = default;
+
+protected:
 
-template<class T>
-constexpr T FtoK(T x) { return (x + 459.67) * 5.0 / 9.0; }
+    void learn(unsigned fields);
 
-template<class T>
-constexpr T CtoF(T x) { return KtoF(CtoK(x)); }
+    time_point apply_rules(time_point now);
+
+    ZoneController m_zones;
+    Temperature m_outside;
+    ThermalModel m_model;
+    ThermalModel::Segment m_segment;
+    Rules m_rules;
+    Checkpoint* m_checkpoint{nullptr};
+    unsigned m_outputs{0};
+    time_point m_outputs_time;
+};
 
 #endif
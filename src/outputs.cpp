@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "outputs.h"
+#include <cstdio>
+#include <cstring>
+#include <egt/app.h>
+#include <egt/asio.hpp>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char GPIO_PREFIX[] = "gpio:";
+static const char SYSFS_PREFIX[] = "sysfs:";
+static const char FILE_PREFIX[] = "file:";
+
+/// How long to wait before writing again after a backend error.
+static constexpr auto RETRY = std::chrono::seconds(5);
+
+static constexpr auto BOTH = (1u << HvacOutputs::heat) | (1u << HvacOutputs::cool);
+
+bool GpioChipOutputs::open(const std::string& chip, const std::array<int, 3>& lines,
+                           unsigned levels)
+{
+    const auto path = chip.find('/') == std::string::npos ? "/dev/" + chip : chip;
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    // lines come up at their default_values, so never glitch
+    gpiohandle_request req{};
+    req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    std::strncpy(req.consumer_label, "egt-thermostat", sizeof(req.consumer_label) - 1);
+    for (auto i = 0; i < HvacOutputs::count; ++i)
+    {
+        if (lines[i] < 0)
+            continue;
+        req.lineoffsets[req.lines] = lines[i];
+        req.default_values[req.lines] = (levels >> i) & 1;
+        m_outputs[req.lines] = i;
+        ++req.lines;
+    }
+
+    const auto ret = req.lines ? ::ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &req) : -1;
+    ::close(fd);
+    if (ret < 0)
+        return false;
+
+    m_fd = req.fd;
+    m_count = req.lines;
+    return true;
+}
+
+bool GpioChipOutputs::write(unsigned levels)
+{
+    gpiohandle_data data{};
+    for (unsigned i = 0; i < m_count; ++i)
+        data.values[i] = (levels >> m_outputs[i]) & 1;
+    return ::ioctl(m_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) >= 0;
+}
+
+GpioChipOutputs::~GpioChipOutputs()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+static bool write_attr(const std::string& path, const std::string& value)
+{
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    const auto ret = ::write(fd, value.data(), value.size());
+    ::close(fd);
+    return ret == static_cast<ssize_t>(value.size());
+}
+
+bool SysfsGpioOutputs::open(const std::array<int, 3>& gpios, unsigned levels,
+                            const std::string& root)
+{
+    for (auto i = 0; i < HvacOutputs::count; ++i)
+    {
+        if (gpios[i] < 0)
+            continue;
+
+        const auto dir = root + "/gpio" + std::to_string(gpios[i]);
+        if (::access(dir.c_str(), F_OK) != 0)
+            write_attr(root + "/export", std::to_string(gpios[i]));
+
+        // "low" and "high" set the direction and the level at once, so the
+        // line never glitches
+        if (!write_attr(dir + "/direction", (levels >> i) & 1 ? "high" : "low"))
+            return false;
+
+        m_fds[i] = ::open((dir + "/value").c_str(), O_WRONLY | O_CLOEXEC);
+        if (m_fds[i] < 0)
+            return false;
+    }
+
+    m_last = levels;
+    m_written = true;
+    return true;
+}
+
+bool SysfsGpioOutputs::write(unsigned levels)
+{
+    bool ok = true;
+    for (auto i = 0; i < HvacOutputs::count; ++i)
+    {
+        const auto level = (levels >> i) & 1;
+        if (m_fds[i] < 0 || (m_written && level == ((m_last >> i) & 1)))
+            continue;
+
+        if (::pwrite(m_fds[i], level ? "1" : "0", 1, 0) != 1)
+            ok = false;
+    }
+
+    if (ok)
+    {
+        m_last = levels;
+        m_written = true;
+    }
+    return ok;
+}
+
+SysfsGpioOutputs::~SysfsGpioOutputs()
+{
+    for (auto fd : m_fds)
+        if (fd >= 0)
+            ::close(fd);
+}
+
+bool FileOutputs::open(const std::string& path, unsigned levels)
+{
+    // read/write so a FIFO opens without a reader, and a full FIFO is an
+    // error instead of a stuck worker
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_NONBLOCK | O_CLOEXEC, 0644);
+    return m_fd >= 0 && write(levels);
+}
+
+bool FileOutputs::write(unsigned levels)
+{
+    char buf[32];
+    const auto len = std::snprintf(buf, sizeof(buf), "fan=%u heat=%u cool=%u\n",
+                                   (levels >> HvacOutputs::fan) & 1,
+                                   (levels >> HvacOutputs::heat) & 1,
+                                   (levels >> HvacOutputs::cool) & 1);
+    return ::write(m_fd, buf, len) == len;
+}
+
+FileOutputs::~FileOutputs()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+/// Parse "fan,heat,cool" numbers, "-" for an output that is not connected.
+static bool parse_lines(const std::string& str, std::array<int, 3>& lines)
+{
+    std::istringstream ss(str);
+    std::string item;
+    size_t i = 0;
+    while (std::getline(ss, item, ','))
+    {
+        if (i >= lines.size())
+            return false;
+
+        char* end = nullptr;
+        const auto value = std::strtol(item.c_str(), &end, 10);
+        if (item == "-")
+            lines[i] = -1;
+        else if (!item.empty() && !*end && value >= 0)
+            lines[i] = static_cast<int>(value);
+        else
+            return false;
+        ++i;
+    }
+    return i == lines.size();
+}
+
+std::unique_ptr<OutputBackend> open_output_backend(const std::string& name,
+        unsigned levels)
+{
+    std::array<int, 3> lines{};
+
+    if (name.compare(0, sizeof(GPIO_PREFIX) - 1, GPIO_PREFIX) == 0)
+    {
+        const auto spec = name.substr(sizeof(GPIO_PREFIX) - 1);
+        const auto colon = spec.rfind(':');
+        auto backend = std::make_unique<GpioChipOutputs>();
+        if (colon != std::string::npos &&
+            parse_lines(spec.substr(colon + 1), lines) &&
+            backend->open(spec.substr(0, colon), lines, levels))
+            return backend;
+    }
+    else if (name.compare(0, sizeof(SYSFS_PREFIX) - 1, SYSFS_PREFIX) == 0)
+    {
+        auto backend = std::make_unique<SysfsGpioOutputs>();
+        if (parse_lines(name.substr(sizeof(SYSFS_PREFIX) - 1), lines) &&
+            backend->open(lines, levels))
+            return backend;
+    }
+    else if (name.compare(0, sizeof(FILE_PREFIX) - 1, FILE_PREFIX) == 0)
+    {
+        auto backend = std::make_unique<FileOutputs>();
+        if (backend->open(name.substr(sizeof(FILE_PREFIX) - 1), levels))
+            return backend;
+    }
+
+    return nullptr;
+}
+
+struct HvacOutputs::watch_impl
+{
+    explicit watch_impl(int fd)
+        : input(egt::Application::instance().event().io(), fd)
+    {}
+
+    asio::posix::stream_descriptor input;
+};
+
+HvacOutputs::HvacOutputs(std::chrono::milliseconds dead_time)
+    : m_dead_time(dead_time),
+      m_event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      m_watch(std::make_unique<watch_impl>(::dup(m_event_fd)))
+{
+}
+
+void HvacOutputs::select(const std::string& name)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_name = name;
+        ++m_request;
+    }
+    m_cv.notify_one();
+}
+
+void HvacOutputs::set(unsigned levels)
+{
+    const auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (levels == m_wanted)
+            return;
+
+        ++m_stats.requests;
+        if (m_pending)
+            ++m_stats.coalesced;
+
+        for (auto i = 0; i < count; ++i)
+            if (((levels ^ m_wanted) >> i) & 1)
+                m_changed[i] = now;
+
+        m_wanted = levels;
+        m_pending = true;
+    }
+    m_cv.notify_one();
+}
+
+void HvacOutputs::on_confirm(confirm_callback_t callback)
+{
+    m_callback = std::move(callback);
+}
+
+void HvacOutputs::start()
+{
+    if (m_thread.joinable())
+        return;
+
+    m_stop = false;
+    m_thread = std::thread(&HvacOutputs::run, this);
+    arm();
+}
+
+void HvacOutputs::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+
+    if (m_thread.joinable())
+        m_thread.join();
+
+    m_watch->input.cancel();
+}
+
+void HvacOutputs::run()
+{
+    std::unique_ptr<OutputBackend> backend;
+    unsigned int request = 0;
+    bool missing = false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop)
+    {
+        if (request != m_request)
+        {
+            request = m_request;
+            const auto name = m_name;
+            // the new hardware starts at the levels already wanted, which
+            // before start() are the levels a restart resumes at
+            auto levels = m_wanted;
+            if ((levels & BOTH) == BOTH)
+                levels &= ~BOTH;
+            lock.unlock();
+
+            // leave the old hardware off
+            if (backend)
+                backend->write(0);
+            backend = open_output_backend(name, levels);
+            missing = !backend && !name.empty();
+            if (missing)
+                ++m_stats.errors;
+            m_applied = backend ? levels : 0;
+            if (backend)
+                confirm(levels, std::chrono::steady_clock::now());
+
+            lock.lock();
+            m_pending = true;
+            continue;
+        }
+
+        // nothing to drive, and nothing to confirm
+        if (!m_pending || missing)
+        {
+            m_pending = false;
+            m_cv.wait(lock);
+            continue;
+        }
+
+        const auto wanted = m_wanted;
+        const auto changed = m_changed;
+        m_pending = false;
+        lock.unlock();
+
+        const auto ok = apply(backend.get(), wanted, changed);
+
+        lock.lock();
+        if (!ok && !m_stop)
+        {
+            m_pending = true;
+            m_cv.wait_for(lock, RETRY);
+        }
+    }
+    lock.unlock();
+
+    if (backend && !m_hold)
+        backend->write(0);
+}
+
+bool HvacOutputs::apply(OutputBackend* backend, unsigned levels,
+                        const std::array<std::chrono::steady_clock::time_point, count>& changed)
+{
+    if ((levels & BOTH) == BOTH)
+    {
+        levels &= ~BOTH;
+        ++m_stats.conflicts;
+    }
+
+    const auto off = m_applied & ~levels;
+    const auto on = levels & ~m_applied;
+    if (!off && !on)
+        return true;
+
+    if (backend)
+    {
+        if (off)
+        {
+            if (!backend->write(m_applied & levels))
+            {
+                ++m_stats.errors;
+                return false;
+            }
+            ++m_stats.writes;
+            m_applied &= levels;
+
+            const auto now = std::chrono::steady_clock::now();
+            for (auto i = 0; i < count; ++i)
+            {
+                if ((off >> i) & 1)
+                    m_off[i] = now;
+            }
+        }
+
+        if (on)
+        {
+            // give the relay of one stage time to release before the other,
+            // however many requests it took to get from one to the other
+            auto other = std::chrono::steady_clock::time_point();
+            if (on & (1u << heat))
+                other = std::max(other, m_off[cool]);
+            if (on & (1u << cool))
+                other = std::max(other, m_off[heat]);
+            const auto until = other + m_dead_time;
+            if (other != std::chrono::steady_clock::time_point() &&
+                std::chrono::steady_clock::now() < until)
+            {
+                ++m_stats.interlocks;
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_cv.wait_until(lock, until, [this]() { return m_stop; }))
+                    return false;
+            }
+
+            if (!backend->write(levels))
+            {
+                ++m_stats.errors;
+                return false;
+            }
+            ++m_stats.writes;
+        }
+    }
+
+    m_applied = levels;
+
+    const auto now = std::chrono::steady_clock::now();
+    for (auto i = 0; i < count; ++i)
+    {
+        if (!(((off | on) >> i) & 1) || changed[i] == std::chrono::steady_clock::time_point())
+            continue;
+
+        auto& latency = m_stats.latency[i];
+        const long long us =
+            std::chrono::duration_cast<std::chrono::microseconds>(now - changed[i]).count();
+        ++latency.changes;
+        latency.last_us = us;
+        latency.total_us += us;
+        if (us > latency.max_us)
+            latency.max_us = us;
+    }
+
+    confirm(levels, now);
+    return true;
+}
+
+void HvacOutputs::confirm(unsigned levels, std::chrono::steady_clock::time_point time)
+{
+    if (m_ring.push({levels, time}))
+    {
+        const uint64_t one = 1;
+        if (::write(m_event_fd, &one, sizeof(one)) < 0)
+        {
+            // eventfd counter saturated; the UI thread will drain anyway
+        }
+    }
+}
+
+void HvacOutputs::arm()
+{
+    m_watch->input.async_wait(asio::posix::stream_descriptor::wait_read,
+                              [this](const asio::error_code & error)
+    {
+        if (error)
+            return;
+
+        drain();
+        arm();
+    });
+}
+
+void HvacOutputs::drain()
+{
+    uint64_t pending;
+    if (::read(m_event_fd, &pending, sizeof(pending)) < 0)
+    {
+        // nothing pending
+    }
+
+    Actuation latest;
+    bool have = false;
+    Actuation actuation;
+    while (m_ring.pop(actuation))
+    {
+        latest = actuation;
+        have = true;
+    }
+
+    if (have && m_callback)
+        m_callback(latest);
+}
+
+HvacOutputs::~HvacOutputs()
+{
+    stop();
+    m_watch.reset();
+    if (m_event_fd >= 0)
+        ::close(m_event_fd);
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef OUTPUTS_H
+#define OUTPUTS_H
+
+#include "sampler.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Hardware behind the HVAC outputs.
+ *
+ * Only ever used from the HvacOutputs worker thread, so implementations
+ * may block.
+ */
+class OutputBackend
+{
+public:
+
+    /// Drive every output, as a mask of 1 << HvacOutputs::output.
+    virtual bool write(unsigned levels) = 0;
+
+    virtual ~OutputBackend() = default;
+};
+
+/**
+ * Lines requested from a GPIO character device, for example
+ * "gpio:gpiochip0:17,27,22".  All lines change in one ioctl.
+ */
+class GpioChipOutputs : public OutputBackend
+{
+public:
+
+    /// Request the lines at levels, -1 for an output that is not connected.
+    bool open(const std::string& chip, const std::array<int, 3>& lines,
+              unsigned levels = 0);
+
+    bool write(unsigned levels) override;
+
+    virtual ~GpioChipOutputs();
+
+protected:
+
+    int m_fd{-1};
+    /// output of each requested line
+    std::array<int, 3> m_outputs{};
+    unsigned m_count{0};
+};
+
+/**
+ * Legacy sysfs GPIO numbers, for example "sysfs:17,27,22".  Lines are
+ * exported if needed and only the ones that change are written.
+ */
+class SysfsGpioOutputs : public OutputBackend
+{
+public:
+
+    /// Export and open the lines at levels, -1 for an output that is not connected.
+    bool open(const std::array<int, 3>& gpios, unsigned levels = 0,
+              const std::string& root = "/sys/class/gpio");
+
+    bool write(unsigned levels) override;
+
+    virtual ~SysfsGpioOutputs();
+
+protected:
+
+    std::array<int, 3> m_fds{{-1, -1, -1}};
+    unsigned m_last{0};
+    bool m_written{false};
+};
+
+/**
+ * A file or FIFO that gets one "fan=1 heat=0 cool=0" line per write, for
+ * example "file:/tmp/hvac".  A stand-in for hardware in tests.
+ */
+class FileOutputs : public OutputBackend
+{
+public:
+
+    /// Open and write the initial levels.
+    bool open(const std::string& path, unsigned levels = 0);
+
+    bool write(unsigned levels) override;
+
+    virtual ~FileOutputs();
+
+protected:
+
+    int m_fd{-1};
+};
+
+/**
+ * Open the backend named by an hvac_output setting, nullptr if none or on
+ * error.  Outputs start at levels, without passing through off.
+ */
+std::unique_ptr<OutputBackend> open_output_backend(const std::string& name,
+        unsigned levels = 0);
+
+/**
+ * Drives the fan, heat and cool outputs on a dedicated thread.
+ *
+ * set() only records the wanted levels, so the UI thread never blocks on
+ * hardware.  The worker applies the latest levels only, however many
+ * requests came in while it was busy.  Outputs turning off are written
+ * before outputs turning on, and heat or cool waits the dead time after the
+ * other turned off, even through off, so heat and cool are never asserted
+ * together.  Applied levels are confirmed back on the UI thread through an
+ * SpscRing and an eventfd watched by the EGT event loop.
+ */
+class HvacOutputs
+{
+public:
+
+    enum output
+    {
+        fan,
+        heat,
+        cool,
+        count,
+    };
+
+    static inline unsigned levels(bool fan_on, bool heat_on, bool cool_on)
+    {
+        return (fan_on ? 1u << fan : 0u) |
+               (heat_on ? 1u << heat : 0u) |
+               (cool_on ? 1u << cool : 0u);
+    }
+
+    /// Levels written to the hardware.
+    struct Actuation
+    {
+        unsigned levels{0};
+        std::chrono::steady_clock::time_point time;
+    };
+
+    /// From the request that changed an output to its write completing.
+    struct Latency
+    {
+        std::atomic<unsigned long> changes{0};
+        std::atomic<long long> last_us{0};
+        std::atomic<long long> max_us{0};
+        std::atomic<long long> total_us{0};
+    };
+
+    struct Stats
+    {
+        std::atomic<unsigned long> requests{0};
+        /// requests replaced by a later one before being applied
+        std::atomic<unsigned long> coalesced{0};
+        std::atomic<unsigned long> writes{0};
+        std::atomic<unsigned long> errors{0};
+        /// requests with heat and cool both on, applied with both off
+        std::atomic<unsigned long> conflicts{0};
+        /// heat or cool held back for the dead time after the other
+        std::atomic<unsigned long> interlocks{0};
+        std::array<Latency, count> latency;
+    };
+
+    using confirm_callback_t = std::function<void(const Actuation&)>;
+
+    explicit HvacOutputs(std::chrono::milliseconds dead_time = std::chrono::seconds(1));
+
+    HvacOutputs(const HvacOutputs&) = delete;
+    HvacOutputs& operator=(const HvacOutputs&) = delete;
+
+    /// Select the backend by name, see open_output_backend().
+    void select(const std::string& name);
+
+    /// Request output levels.  Never blocks.  Levels set before start() are
+    /// the levels the backend opens at.
+    void set(unsigned levels);
+
+    /// Called on the UI thread with the latest levels applied.
+    void on_confirm(confirm_callback_t callback);
+
+    void start();
+
+    /**
+     * Leave the outputs as they are on stop(), for a restart to take over
+     * without the equipment cycling.
+     */
+    inline void hold(bool hold) { m_hold = hold; }
+
+    /// Turn every output off, unless held, and stop the worker.
+    void stop();
+
+    inline const Stats& stats() const { return m_stats; }
+
+    virtual ~HvacOutputs();
+
+protected:
+
+    void run();
+    bool apply(OutputBackend* backend, unsigned levels,
+               const std::array<std::chrono::steady_clock::time_point, count>& changed);
+    void confirm(unsigned levels, std::chrono::steady_clock::time_point time);
+    void arm();
+    void drain();
+
+    std::chrono::milliseconds m_dead_time;
+    SpscRing<Actuation, 16> m_ring;
+    Stats m_stats;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::string m_name;
+    unsigned int m_request{0};
+    unsigned m_wanted{0};
+    bool m_pending{false};
+    /// when each output last changed in a request
+    std::array<std::chrono::steady_clock::time_point, count> m_changed{};
+    bool m_stop{false};
+    std::atomic<bool> m_hold{false};
+
+    /// worker thread only
+    unsigned m_applied{0};
+    /// when each output last turned off
+    std::array<std::chrono::steady_clock::time_point, count> m_off{};
+
+    std::thread m_thread;
+    int m_event_fd{-1};
+
+    struct watch_impl;
+    std::unique_ptr<watch_impl> m_watch;
+    confirm_callback_t m_callback;
+};
+
+#endif
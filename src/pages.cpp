@@ -8,6 +8,7 @@
 #include "sensors.h"
 #include "settings.h"
 #include "window.h"
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <libintl.h>
@@ -21,20 +22,14 @@ using namespace std;
  */
 #define _(String) gettext(String)
 
-template<class T>
-constexpr static inline T f2c(T f)
+static inline Temperature::unit display_unit()
 {
-    return f * 5. / 9.;
+    return settings().choice<setting::degrees, Temperature::unit>();
 }
 
-static inline std::string format_temp(float temp)
+static inline std::string format_temp(Temperature temp)
 {
-    ostringstream ss;
-    if (settings().get("degrees") == "f")
-        ss << std::round(CtoF(temp)) << "°";
-    else
-        ss << std::round(temp) << "°";
-    return ss.str();
+    return std::to_string(temp.display(display_unit())) + "°";
 }
 
 static void selectable_btn_setup(const shared_ptr<ImageButton>& button)
@@ -105,23 +100,21 @@ IdlePage::IdlePage(ThermostatWindow& window, Logic& logic)
     hsizer->add(m_status);
 
     apply_logic_change(m_logic.current_status());
-    logic.on_logic_change([this]()
-    {
-        apply_logic_change(m_logic.current_status());
-    });
-
     apply_temperature_change();
-    logic.on_temperature_change([this]()
+    logic.on_change([this](unsigned changed)
     {
-        apply_temperature_change();
+        if (changed & (Logic::dirty::status | Logic::dirty::target | Logic::dirty::mode))
+            apply_logic_change(m_logic.current_status());
+        if (changed & Logic::dirty::current)
+            apply_temperature_change();
     });
 }
 
 void IdlePage::enter()
 {
-    if (settings().get("outside") == "on")
+    if (settings().flag<setting::outside>())
     {
-        m_otemp->text(std::string(_("Outside")) + " " + format_temp(30));
+        m_otemp->text(std::string(_("Outside")) + " " + format_temp(m_logic.outside()));
         if (m_otemp->min_size_hint().width() > m_otemp->width())
             m_otemp->resize(m_otemp->min_size_hint());
         m_otemp->show();
@@ -134,7 +127,8 @@ void IdlePage::enter()
 
 void IdlePage::apply_temperature_change()
 {
-    m_temp->text(format_temp(m_logic.current()));
+    // a failed sensor shows no temperature rather than the last one
+    m_temp->text(m_logic.current_valid() ? format_temp(m_logic.current()) : "--");
 }
 
 void IdlePage::apply_logic_change(Logic::status status)
@@ -278,10 +272,7 @@ MainPage::MainPage(ThermostatWindow& window, Logic& logic)
                 break;
             case EventId::pointer_click:
             case EventId::pointer_hold:
-                if (settings().get("degrees") == "f")
-                    m_logic.change_target(m_logic.target() + f2c<float>(1.));
-                else
-                    m_logic.change_target(m_logic.target() + 1.);
+                m_logic.change_target(m_logic.target().step(1, display_unit()));
                 break;
             default:
                 break;
@@ -305,10 +296,7 @@ MainPage::MainPage(ThermostatWindow& window, Logic& logic)
                 break;
             case EventId::pointer_click:
             case EventId::pointer_hold:
-                if (settings().get("degrees") == "f")
-                    m_logic.change_target(m_logic.target() - f2c<float>(1.));
-                else
-                    m_logic.change_target(m_logic.target() - 1.);
+                m_logic.change_target(m_logic.target().step(-1, display_unit()));
                 break;
             default:
                 break;
@@ -317,15 +305,13 @@ MainPage::MainPage(ThermostatWindow& window, Logic& logic)
     });
 
     apply_logic_change(m_logic.current_status());
-    logic.on_logic_change([this]()
-    {
-        apply_logic_change(m_logic.current_status());
-    });
-
     apply_temperature_change();
-    logic.on_temperature_change([this]()
+    logic.on_change([this](unsigned changed)
     {
-        apply_temperature_change();
+        if (changed & (Logic::dirty::status | Logic::dirty::target | Logic::dirty::mode))
+            apply_logic_change(m_logic.current_status());
+        if (changed & Logic::dirty::current)
+            apply_temperature_change();
     });
 
     auto sizer = make_shared<HorizontalBoxSizer>();
@@ -400,6 +386,21 @@ MainPage::MainPage(ThermostatWindow& window, Logic& logic)
         if (++m_background_index > 5)
             m_background_index = 0;
     });
+
+    // redrawn when a settings page changes them, not on every enter()
+    apply_background();
+    apply_modes();
+    settings().on_change("background").on_event([this](const std::string&, const std::string&)
+    {
+        apply_background();
+    });
+    for (const auto key : {"mode", "fan"})
+    {
+        settings().on_change(key).on_event([this](const std::string&, const std::string&)
+        {
+            apply_modes();
+        });
+    }
 }
 
 static inline std::string capitalize(const std::string& s)
@@ -422,9 +423,9 @@ void MainPage::shrink_camera()
     }
 }
 
-void MainPage::enter()
+void MainPage::apply_background()
 {
-    if (settings().get("background") == "on")
+    if (settings().flag<setting::background>())
     {
         m_window.background(Image("file:background" + std::to_string(m_background_index) + ".png"));
         fill_flags().clear();
@@ -436,10 +437,25 @@ void MainPage::enter()
         m_window.background(Image());
         fill_flags(Theme::FillFlag::blend);
     }
+}
+
+void MainPage::apply_modes()
+{
+    m_layout->visible(settings().choice<setting::mode, Logic::mode>() != Logic::mode::off);
+
+    const auto& mode = settings().get("mode");
+    m_mode->text(string("System ") + capitalize(mode));
+    m_mode->image(Image("file:" + mode + ".png", 0.3));
+    const auto& fan = settings().get("fan");
+    m_fan->text(string("Fan ") + capitalize(fan));
+    m_fan->image(Image("file:fan_" + fan + ".png", 0.3));
+}
 
-    if (settings().get("outside") == "on")
+void MainPage::enter()
+{
+    if (settings().flag<setting::outside>())
     {
-        m_otemp->text(std::string(_("Outside")) + " " + format_temp(30));
+        m_otemp->text(std::string(_("Outside")) + " " + format_temp(m_logic.outside()));
         if (m_otemp->min_size_hint().width() > m_otemp->width())
             m_otemp->resize(m_otemp->min_size_hint());
         m_otemp->show();
@@ -449,22 +465,10 @@ void MainPage::enter()
         m_otemp->hide();
     }
 
-    m_layout->visible(settings().get("mode") != "off");
-
-    auto mode = settings().get("mode");
-    m_mode->text(string("System ") + capitalize(mode));
-    m_mode->image(Image("file:" + mode + ".png", 0.3));
-    auto fan = settings().get("fan");
-    m_fan->text(string("Fan ") + capitalize(fan));
-    m_fan->image(Image("file:fan_" + fan + ".png", 0.3));
-
 #ifdef EGT_HAS_CAMERA
     if (m_camera->play())
         m_camera->show();
 #endif
-
-    // hack
-    m_logic.refresh();
 }
 
 bool MainPage::leave()
@@ -479,7 +483,8 @@ bool MainPage::leave()
 
 void MainPage::apply_temperature_change()
 {
-    m_temp->text(format_temp(m_logic.current()));
+    // a failed sensor shows no temperature rather than the last one
+    m_temp->text(m_logic.current_valid() ? format_temp(m_logic.current()) : "--");
 }
 
 void MainPage::apply_logic_change(Logic::status status)
@@ -579,18 +584,10 @@ bool ModePage::leave()
 {
     Settings::AutoTransaction tx(settings());
 
-    m_button_group->foreach_checked([this](Button & button)
+    m_button_group->foreach_checked([](Button & button)
     {
+        // Logic follows the setting
         settings().set("mode", button.name());
-
-        if (button.name() == "auto")
-            m_logic.set_mode(Logic::mode::automatic);
-        else if (button.name() == "heat")
-            m_logic.set_mode(Logic::mode::heating);
-        else if (button.name() == "cool")
-            m_logic.set_mode(Logic::mode::cooling);
-        else if (button.name() == "off")
-            m_logic.set_mode(Logic::mode::off);
     });
 
     return true;
@@ -625,14 +622,10 @@ bool FanPage::leave()
 {
     Settings::AutoTransaction tx(settings());
 
-    m_button_group->foreach_checked([this](Button & button)
+    m_button_group->foreach_checked([](Button & button)
     {
+        // Logic follows the setting
         settings().set("fan", button.name());
-
-        if (button.name() == "on")
-            m_logic.set_fan_mode(Logic::fanmode::on);
-        else
-            m_logic.set_fan_mode(Logic::fanmode::automatic);
     });
 
     return true;
@@ -651,7 +644,7 @@ IdleSettingsPage::IdleSettingsPage(ThermostatWindow& window, Logic& logic)
     sizer->add(make_shared<Label>(_("Seconds idle before entering idle mode")));
 
     m_idle_timeout = std::make_shared<Slider>(10, 120,
-                     std::stoi(settings().get("sleep_timeout")));
+                     settings().integer<setting::sleep_timeout>());
     m_idle_timeout->height(100);
     m_idle_timeout->align(AlignFlag::expand_horizontal);
     m_idle_timeout->slider_flags().set({Slider::SliderFlag::round_handle, Slider::SliderFlag::show_label});
@@ -661,7 +654,7 @@ IdleSettingsPage::IdleSettingsPage(ThermostatWindow& window, Logic& logic)
 
     m_sleep_brightness = std::make_shared<Slider>(3,
                          Application::instance().screen()->max_brightness(),
-                         std::stoi(settings().get("sleep_brightness")));
+                         settings().integer<setting::sleep_brightness>());
     m_sleep_brightness->height(100);
     m_sleep_brightness->align(AlignFlag::expand_horizontal);
     m_sleep_brightness->slider_flags().set({Slider::SliderFlag::round_handle, Slider::SliderFlag::show_label});
@@ -675,9 +668,6 @@ bool IdleSettingsPage::leave()
     settings().set("sleep_brightness", std::to_string(m_sleep_brightness->value()));
     settings().set("sleep_timeout", std::to_string(m_idle_timeout->value()));
 
-    m_window.m_idle_timer.change_duration(
-        std::chrono::seconds(std::stoi(settings().get("sleep_timeout"))));
-
     return true;
 }
 
@@ -694,7 +684,7 @@ ScreenBrightnessPage::ScreenBrightnessPage(ThermostatWindow& window, Logic& logi
 
     auto normal_brightness = std::make_shared<Slider>(3,
                              Application::instance().screen()->max_brightness(),
-                             std::stoi(settings().get("normal_brightness")));
+                             settings().integer<setting::normal_brightness>());
     normal_brightness->height(100);
     normal_brightness->align(AlignFlag::expand_horizontal);
     normal_brightness->slider_flags().set({Slider::SliderFlag::round_handle, Slider::SliderFlag::show_label});
@@ -797,35 +787,35 @@ HomeContentPage::HomeContentPage(ThermostatWindow& window, Logic& logic)
     m_showoutside->border_radius(4.0);
     m_showoutside->toggle_text(_("Off"), _("On"));
     m_showoutside->enable_disable(false);
-    m_showoutside->checked(settings().get("outside") == "on");
+    m_showoutside->checked(settings().flag<setting::outside>());
     form->add_option(_("Outside temp"), m_showoutside);
 
     m_degrees = make_shared<ToggleBox>();
     m_degrees->border_radius(4.0);
     m_degrees->toggle_text(_("Fahrenheit"), _("Celsius"));
     m_degrees->enable_disable(false);
-    m_degrees->checked(settings().get("degrees") == "c");
+    m_degrees->checked(settings().choice<setting::degrees, Temperature::unit>() == Temperature::unit::celsius);
     form->add_option(_("Display degrees"), m_degrees);
 
     m_usebackground = make_shared<ToggleBox>();
     m_usebackground->border_radius(4.0);
     m_usebackground->toggle_text(_("Off"), _("On"));
     m_usebackground->enable_disable(false);
-    m_usebackground->checked(settings().get("background") == "on");
+    m_usebackground->checked(settings().flag<setting::background>());
     form->add_option(_("Background Image"), m_usebackground);
 
     m_time_format = make_shared<ToggleBox>();
     m_time_format->border_radius(4.0);
     m_time_format->toggle_text(_("12 Hour"), _("24 Hour"));
     m_time_format->enable_disable(false);
-    m_time_format->checked(settings().get("time_format") == "24");
+    m_time_format->checked(settings().integer<setting::time_format>() == 24);
     form->add_option(_("Time format"), m_time_format);
 
     m_sql_logs = make_shared<ToggleBox>();
     m_sql_logs->border_radius(4.0);
     m_sql_logs->toggle_text(_("Off"), _("On"));
     m_sql_logs->enable_disable(false);
-    m_sql_logs->checked(settings().get("sql_logs") == "on");
+    m_sql_logs->checked(settings().flag<setting::sql_logs>());
     form->add_option(_("SQL logs (temperature and status)"), m_sql_logs);
 
 #if 0
@@ -871,9 +861,6 @@ bool HomeContentPage::leave()
     else
         settings().set("sql_logs", "off");
 
-    // hack
-    m_logic.refresh();
-
     return true;
 }
 
@@ -884,18 +871,40 @@ SensorsPage::SensorsPage(ThermostatWindow& window, Logic& logic)
 
     layout->add(make_shared<Label>(_("Select the sensor to use for internal temperature")));
 
+    m_list = make_shared<VerticalBoxSizer>(Justification::start);
+    layout->add(expand_horizontal(m_list));
+    populate();
+
+    // sensors plugged in or removed while running
+    sensor_catalog().on_change([this]()
+    {
+        populate();
+    });
+}
+
+void SensorsPage::populate()
+{
+    auto checked = settings().get("temp_sensor");
+    if (m_checkbox_group)
+    {
+        m_checkbox_group->foreach_checked([&checked](Button & button)
+        {
+            checked = button.name();
+        });
+    }
+
+    m_list->remove_all();
     m_checkbox_group = std::make_unique<ButtonGroup>(true, true);
 
-    const auto sensors = enumerate_temp_sensors();
-    for (const auto& sensor : sensors)
+    for (const auto& sensor : sensor_catalog().sensors())
     {
         auto checkbox = std::make_shared<CheckBox>(sensor);
-        if (settings().get("temp_sensor") == sensor)
+        if (checked == sensor)
             checkbox->checked(true);
         checkbox->align(AlignFlag::left);
         checkbox->margin(5);
         checkbox->name(sensor);
-        layout->add(checkbox);
+        m_list->add(checkbox);
         m_checkbox_group->add(checkbox);
     }
 }
@@ -904,7 +913,8 @@ bool SensorsPage::leave()
 {
     m_checkbox_group->foreach_checked([](Button & button)
     {
-        settings().set("temp_sensor", button.name());
+        if (settings().get("temp_sensor") != button.name())
+            settings().set("temp_sensor", button.name());
     });
 
     return true;
@@ -940,7 +950,7 @@ SchedulePage::SchedulePage(ThermostatWindow& window, Logic& logic)
     m_enabled->margin(2);
     m_enabled->toggle_text(_("Off"), _("On"));
     m_enabled->enable_disable(false);
-    m_enabled->checked(settings().get("schedule_enabled") == "on");
+    m_enabled->checked(settings().flag<setting::schedule_enabled>());
     form->name_align(AlignFlag::center);
     form->add_option(_("Schedule Enabled"), m_enabled);
 
@@ -948,7 +958,7 @@ SchedulePage::SchedulePage(ThermostatWindow& window, Logic& logic)
     layout->add(expand(grid));
 
     vector<string> times;
-    for (auto m = 0; m < 24 * 60; m += 15)
+    for (auto m = 0; m < Schedule::DAY_MINUTES; m += Schedule::SLOT_MINUTES)
     {
         ostringstream ss;
         if (((m / 60) % 12) < 1)
@@ -968,17 +978,38 @@ SchedulePage::SchedulePage(ThermostatWindow& window, Logic& logic)
     for (auto m = 0; m < 100; m++)
         temps.push_back(std::to_string(m) + "°");
 
-    const auto names = { _("Wake"), _("Leave"), _("Return"), _("Sleep") };
+    const std::array<std::string, PERIODS> names = { _("Wake"), _("Leave"), _("Return"), _("Sleep") };
+
+    // the same program runs every day, so Sunday's transitions are shown
+    std::array<Schedule::Transition, PERIODS> periods;
+    periods[0].minute = 6 * 60;
+    periods[0].target = Temperature::from_celsius(21);
+    periods[1].minute = 8 * 60;
+    periods[1].target = Temperature::from_celsius(16);
+    periods[2].minute = 18 * 60;
+    periods[2].target = Temperature::from_celsius(21);
+    periods[3].minute = 22 * 60;
+    periods[3].target = Temperature::from_celsius(18);
+
+    size_t stored = 0;
+    for (const auto& t : m_window.m_schedule.schedule().transitions())
+    {
+        if (t.dow == 0 && stored < PERIODS)
+            periods[stored++] = t;
+    }
 
     std::weak_ptr<ToggleBox> weak_enabled(m_enabled);
 
-    for (auto& name : names)
+    for (size_t i = 0; i < PERIODS; ++i)
     {
+        const auto& name = names[i];
         grid->add(expand(make_shared<ImageLabel>(Image("file:" + lowercase(name) + ".png"), name)));
         auto time1 = std::make_shared<Scrollwheel>(times);
         time1->orient(Orientation::horizontal);
         time1->image_down(Image("file:wheel_down.png"));
         time1->image_up(Image("file:wheel_up.png"));
+        time1->selected(periods[i].minute / Schedule::SLOT_MINUTES);
+        m_times[i] = time1;
         grid->add(expand(time1));
 
         std::weak_ptr<Scrollwheel> weak_time1(time1);
@@ -996,6 +1027,9 @@ SchedulePage::SchedulePage(ThermostatWindow& window, Logic& logic)
         temp1->orient(Orientation::horizontal);
         temp1->image_down(Image("file:wheel_down.png"));
         temp1->image_up(Image("file:wheel_up.png"));
+        const auto degrees = periods[i].target.display(display_unit());
+        temp1->selected(std::max(0, std::min(degrees, static_cast<int>(temps.size()) - 1)));
+        m_temps[i] = temp1;
         grid->add(expand(temp1));
 
         std::weak_ptr<Scrollwheel> weak_temp1(temp1);
@@ -1039,6 +1073,23 @@ bool SchedulePage::leave()
     else
         settings().set("schedule_enabled", "off");
 
+    std::vector<Schedule::Transition> transitions;
+    for (auto dow = 0; dow < 7; ++dow)
+    {
+        for (size_t i = 0; i < PERIODS; ++i)
+        {
+            Schedule::Transition t;
+            t.dow = dow;
+            t.minute = static_cast<int>(m_times[i]->selected()) * Schedule::SLOT_MINUTES;
+            t.target = Temperature::from_display(static_cast<int>(m_temps[i]->selected()),
+                                                 display_unit());
+            transitions.push_back(t);
+        }
+    }
+    settings().save_schedule(transitions);
+
+    m_window.m_schedule.reload();
+
     return true;
 }
 
@@ -6,6 +6,7 @@
 #ifndef PAGES_H
 #define PAGES_H
 
+#include <array>
 #include <egt/ui>
 #include "logic.h"
 
@@ -50,6 +51,8 @@ struct MainPage : public ThermostatPage
 
     void apply_logic_change(Logic::status status);
     void apply_temperature_change();
+    void apply_background();
+    void apply_modes();
 
     std::shared_ptr<egt::ImageButton> m_menu;
     std::shared_ptr<egt::Label> m_temp;
@@ -92,7 +95,12 @@ struct SchedulePage : public SettingsPage
 
     virtual bool leave() override;
 
+    /// Wake, Leave, Return and Sleep
+    static constexpr size_t PERIODS = 4;
+
     std::shared_ptr<egt::ToggleBox> m_enabled;
+    std::array<std::shared_ptr<egt::Scrollwheel>, PERIODS> m_times;
+    std::array<std::shared_ptr<egt::Scrollwheel>, PERIODS> m_temps;
 };
 
 struct FanPage : public SettingsPage
@@ -141,6 +149,10 @@ struct SensorsPage : public SettingsPage
 {
     SensorsPage(ThermostatWindow& window, Logic& logic);
 
+    /// Fill the list from the sensor catalog, keeping the checked sensor.
+    void populate();
+
+    std::shared_ptr<egt::VerticalBoxSizer> m_list;
     std::unique_ptr<egt::ButtonGroup> m_checkbox_group;
 
     virtual bool leave() override;
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "room.h"
+#include <cmath>
+
+RoomModel::RoomModel(const Parameters& parameters)
+    : m_parameters(parameters),
+      m_temperature(parameters.initial)
+{
+}
+
+void RoomModel::drive(bool heat, bool cool, bool fan)
+{
+    m_heat = heat;
+    m_cool = cool;
+    m_fan = fan;
+}
+
+void RoomModel::step(double seconds)
+{
+    if (seconds <= 0.)
+        return;
+
+    const auto tau = m_parameters.insulation * 3600.;
+    const auto fan = m_fan.load();
+
+    // without the blower running only a fraction of the capacity reaches the room
+    const auto delivery = fan ? 1. : 0.3;
+
+    double rate = 0.;
+    if (m_heat)
+        rate += m_parameters.heating * delivery;
+    if (m_cool)
+        rate -= m_parameters.cooling * delivery;
+    if (fan)
+        rate += m_parameters.fan;
+
+    // dT/dt = (outside - T) / tau + rate, solved over the step
+    const auto equilibrium = m_parameters.outside + rate / 3600. * tau;
+    m_temperature = equilibrium + (m_temperature - equilibrium) * std::exp(-seconds / tau);
+}
+
+void RoomModel::advance(std::chrono::steady_clock::time_point now)
+{
+    if (m_started)
+    {
+        const std::chrono::duration<double> elapsed = now - m_last;
+        step(elapsed.count() * m_parameters.speed);
+    }
+
+    m_last = now;
+    m_started = true;
+}
+
+double RoomModel::sample()
+{
+    advance(std::chrono::steady_clock::now());
+
+    if (m_parameters.noise <= 0.)
+        return m_temperature;
+
+    // xorshift32, deterministic across runs
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    const auto unit = static_cast<double>(m_seed) / 4294967295. * 2. - 1.;
+    return m_temperature + unit * m_parameters.noise;
+}
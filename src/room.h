@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Lumped thermal model of a single room.
+ *
+ * The room exchanges heat with the outside through its envelope and is driven
+ * by the HVAC outputs. Each step uses the exact solution of the first order
+ * model, so it stays stable for any step size and can run much faster than
+ * real time.
+ */
+class RoomModel
+{
+public:
+
+    struct Parameters
+    {
+        /// outside temperature in Celsius
+        double outside{30.};
+        /// starting room temperature in Celsius
+        double initial{22.};
+        /// envelope time constant in hours, higher is better insulated
+        double insulation{4.};
+        /// heating capacity in degrees Celsius per hour, the room levels
+        /// off at outside + heating * insulation, so 32 above freezing
+        double heating{8.};
+        /// cooling capacity in degrees Celsius per hour
+        double cooling{4.};
+        /// heat added by the blower alone in degrees Celsius per hour
+        double fan{0.1};
+        /// peak sensor noise in degrees Celsius
+        double noise{0.};
+        /// simulated seconds per real second
+        double speed{1.};
+    };
+
+    RoomModel() = default;
+
+    explicit RoomModel(const Parameters& parameters);
+
+    /// Set the HVAC outputs driving the room.  Safe to call from any thread.
+    void drive(bool heat, bool cool, bool fan);
+
+    /// Advance the model by a number of simulated seconds.
+    void step(double seconds);
+
+    /// Advance the model to a real time point, scaled by Parameters::speed.
+    void advance(std::chrono::steady_clock::time_point now);
+
+    /// Current room temperature as a sensor would report it.
+    double sample();
+
+    inline double temperature() const { return m_temperature; }
+
+    inline Parameters& parameters() { return m_parameters; }
+
+protected:
+
+    Parameters m_parameters;
+    double m_temperature{m_parameters.initial};
+    std::chrono::steady_clock::time_point m_last;
+    bool m_started{false};
+    uint32_t m_seed{0x9e3779b9};
+
+    std::atomic<bool> m_heat{false};
+    std::atomic<bool> m_cool{false};
+    std::atomic<bool> m_fan{false};
+};
+
+#endif
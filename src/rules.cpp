@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "rules.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+static_assert(static_cast<int>(ZoneController::status::cooling) == 1 &&
+              static_cast<int>(ZoneController::status::heating) == 2,
+              "status constants");
+static_assert(static_cast<int>(ZoneController::mode::automatic) == 1 &&
+              static_cast<int>(ZoneController::mode::cooling) == 2 &&
+              static_cast<int>(ZoneController::mode::heating) == 3,
+              "mode constants");
+
+struct Name
+{
+    const char* name;
+    double value;
+};
+
+static const Name INPUTS[] =
+{
+    {"inside", Rules::input::inside},
+    {"target", Rules::input::target},
+    {"outside", Rules::input::outside},
+    {"minute", Rules::input::minute},
+    {"hour", Rules::input::hour},
+    {"dow", Rules::input::dow},
+    {"status", Rules::input::status},
+    {"mode", Rules::input::mode},
+};
+
+static const Name CONSTANTS[] =
+{
+    {"idle", 0},
+    {"cooling", 1},
+    {"heating", 2},
+    {"off", 0},
+    {"auto", 1},
+    {"cool", 2},
+    {"heat", 3},
+};
+
+template<size_t N>
+static const Name* find(const Name(&names)[N], const string& name)
+{
+    for (const auto& n : names)
+        if (name == n.name)
+            return &n;
+    return nullptr;
+}
+
+/**
+ * Recursive descent parser of one rule, emitting postfix code as it goes.
+ *
+ * Every parse function returns false after setting error.
+ */
+class RuleCompiler
+{
+public:
+
+    using op = Rules::op;
+
+    RuleCompiler(const string& text, vector<Rules::Instruction>& code)
+        : m_text(text),
+          m_code(code)
+    {
+        next();
+    }
+
+    bool rule()
+    {
+        if (!keyword("when"))
+            return fail("expected 'when'");
+        if (!expression())
+            return false;
+        if (!keyword("then"))
+            return fail("expected 'then'");
+
+        unsigned flags = 0;
+        do
+        {
+            if (keyword("fan"))
+                flags |= ZoneController::policy::fan;
+            else if (keyword("lockout"))
+            {
+                if (keyword("heat"))
+                    flags |= ZoneController::policy::no_heat;
+                else if (keyword("cool"))
+                    flags |= ZoneController::policy::no_cool;
+                else
+                    return fail("expected 'heat' or 'cool'");
+            }
+            else
+                return fail("expected an action");
+        }
+        while (symbol(","));
+
+        if (!m_token.empty())
+            return fail("unexpected '" + m_token + "'");
+
+        emit(op::act, static_cast<uint8_t>(flags));
+        return true;
+    }
+
+    string error;
+    unsigned uses{0};
+    size_t max_depth{0};
+
+private:
+
+    /// Move to the next token: a word, a number, or an operator.
+    void next()
+    {
+        while (m_pos < m_text.size() && isspace(static_cast<unsigned char>(m_text[m_pos])))
+            ++m_pos;
+
+        const auto start = m_pos;
+        if (m_pos < m_text.size())
+        {
+            const auto c = static_cast<unsigned char>(m_text[m_pos]);
+            if (isalpha(c) || c == '_')
+            {
+                while (m_pos < m_text.size() &&
+                       (isalnum(static_cast<unsigned char>(m_text[m_pos])) || m_text[m_pos] == '_'))
+                    ++m_pos;
+            }
+            else if (isdigit(c) || c == '.')
+            {
+                while (m_pos < m_text.size() &&
+                       (isdigit(static_cast<unsigned char>(m_text[m_pos])) || m_text[m_pos] == '.'))
+                    ++m_pos;
+            }
+            else if (m_pos + 1 < m_text.size() && m_text[m_pos + 1] == '=' && strchr("<>=!", c))
+                m_pos += 2;
+            else
+                ++m_pos;
+        }
+
+        m_token = m_text.substr(start, m_pos - start);
+    }
+
+    bool keyword(const char* word)
+    {
+        if (m_token != word)
+            return false;
+        next();
+        return true;
+    }
+
+    inline bool symbol(const char* s) { return keyword(s); }
+
+    bool fail(const string& message)
+    {
+        error = message;
+        return false;
+    }
+
+    void emit(op code, uint8_t arg = 0, double value = 0.)
+    {
+        switch (code)
+        {
+        case op::constant:
+        case op::load:
+            ++m_depth;
+            max_depth = std::max(max_depth, m_depth);
+            break;
+        case op::neg:
+        case op::logical_not:
+            // fold constants
+            if (!m_code.empty() && m_code.back().code == op::constant)
+            {
+                auto& a = m_code.back().value;
+                a = code == op::neg ? -a : a == 0.;
+                return;
+            }
+            break;
+        default:
+            --m_depth;
+            if (code != op::act && m_code.size() >= 2 &&
+                m_code[m_code.size() - 1].code == op::constant &&
+                m_code[m_code.size() - 2].code == op::constant)
+            {
+                const auto b = m_code.back().value;
+                m_code.pop_back();
+                auto& a = m_code.back().value;
+                a = Rules::binary(code, a, b);
+                return;
+            }
+            break;
+        }
+
+        m_code.push_back({code, arg, value});
+    }
+
+    bool expression()
+    {
+        if (!conjunction())
+            return false;
+        while (keyword("or"))
+        {
+            if (!conjunction())
+                return false;
+            emit(op::logical_or);
+        }
+        return true;
+    }
+
+    bool conjunction()
+    {
+        if (!negation())
+            return false;
+        while (keyword("and"))
+        {
+            if (!negation())
+                return false;
+            emit(op::logical_and);
+        }
+        return true;
+    }
+
+    bool negation()
+    {
+        if (keyword("not"))
+        {
+            if (!negation())
+                return false;
+            emit(op::logical_not);
+            return true;
+        }
+        return comparison();
+    }
+
+    bool comparison()
+    {
+        if (!sum())
+            return false;
+
+        static const pair<const char*, op> ops[] =
+        {
+            {"<", op::lt}, {"<=", op::le}, {">", op::gt},
+            {">=", op::ge}, {"==", op::eq}, {"!=", op::ne},
+        };
+        for (const auto& o : ops)
+        {
+            if (symbol(o.first))
+            {
+                if (!sum())
+                    return false;
+                emit(o.second);
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool sum()
+    {
+        if (!product())
+            return false;
+        for (;;)
+        {
+            const auto code = m_token == "+" ? op::add : m_token == "-" ? op::sub : op::act;
+            if (code == op::act)
+                return true;
+            next();
+            if (!product())
+                return false;
+            emit(code);
+        }
+    }
+
+    bool product()
+    {
+        if (!unary())
+            return false;
+        for (;;)
+        {
+            const auto code = m_token == "*" ? op::mul :
+                              m_token == "/" ? op::div :
+                              m_token == "%" ? op::mod : op::act;
+            if (code == op::act)
+                return true;
+            next();
+            if (!unary())
+                return false;
+            emit(code);
+        }
+    }
+
+    bool unary()
+    {
+        if (symbol("-"))
+        {
+            if (!unary())
+                return false;
+            emit(op::neg);
+            return true;
+        }
+        return primary();
+    }
+
+    bool primary()
+    {
+        if (symbol("("))
+        {
+            if (!expression())
+                return false;
+            if (!symbol(")"))
+                return fail("expected ')'");
+            return true;
+        }
+
+        if (m_token.empty())
+            return fail("unexpected end of rule");
+
+        if (isdigit(static_cast<unsigned char>(m_token[0])) || m_token[0] == '.')
+        {
+            char* end = nullptr;
+            const auto value = strtod(m_token.c_str(), &end);
+            if (*end)
+                return fail("invalid number '" + m_token + "'");
+            emit(op::constant, 0, value);
+            next();
+            return true;
+        }
+
+        if (const auto n = find(INPUTS, m_token))
+        {
+            const auto index = static_cast<uint8_t>(n->value);
+            uses |= 1u << index;
+            emit(op::load, index);
+            next();
+            return true;
+        }
+
+        if (const auto n = find(CONSTANTS, m_token))
+        {
+            emit(op::constant, 0, n->value);
+            next();
+            return true;
+        }
+
+        return fail("unknown name '" + m_token + "'");
+    }
+
+    const string& m_text;
+    vector<Rules::Instruction>& m_code;
+    size_t m_pos{0};
+    string m_token;
+    size_t m_depth{0};
+};
+
+bool Rules::compile(const string& source)
+{
+    vector<Instruction> timed;
+    vector<Instruction> shared;
+    vector<Instruction> zone;
+    size_t rules = 0;
+    unsigned uses = 0;
+    unsigned shared_uses = 0;
+
+    size_t line = 0;
+    size_t start = 0;
+    while (start <= source.size())
+    {
+        auto end = source.find('\n', start);
+        if (end == string::npos)
+            end = source.size();
+        ++line;
+
+        auto text = source.substr(start, end - start);
+        text = text.substr(0, text.find('#'));
+        start = end + 1;
+
+        size_t from = 0;
+        while (from <= text.size())
+        {
+            auto to = text.find(';', from);
+            if (to == string::npos)
+                to = text.size();
+            const auto rule = text.substr(from, to - from);
+            from = to + 1;
+
+            if (std::all_of(rule.begin(), rule.end(),
+                            [](char c) { return isspace(static_cast<unsigned char>(c)); }))
+                continue;
+
+            vector<Instruction> code;
+            RuleCompiler compiler(rule, code);
+            auto ok = compiler.rule();
+            if (ok && compiler.max_depth > MAX_STACK)
+            {
+                compiler.error = "expression too deep";
+                ok = false;
+            }
+            if (!ok)
+            {
+                m_error = "line " + to_string(line) + ": " + compiler.error;
+                return false;
+            }
+
+            auto& to_program = compiler.uses & ZONE_INPUTS ? zone :
+                               compiler.uses & ~TIME_INPUTS ? shared : timed;
+            to_program.insert(to_program.end(), code.begin(), code.end());
+            if (&to_program == &shared)
+                shared_uses |= compiler.uses;
+            uses |= compiler.uses;
+            ++rules;
+        }
+    }
+
+    m_week.clear();
+    if (!timed.empty())
+    {
+        m_week.resize(WEEK_MINUTES);
+        Inputs inputs{};
+        for (auto minute = 0; minute < WEEK_MINUTES; ++minute)
+        {
+            inputs[input::minute] = minute % 60;
+            inputs[input::hour] = minute / 60 % 24;
+            inputs[input::dow] = minute / (24 * 60);
+            m_week[minute] = static_cast<uint8_t>(execute(timed, inputs));
+        }
+    }
+
+    m_timed = std::move(timed);
+    m_shared = std::move(shared);
+    m_zone = std::move(zone);
+    m_cached = false;
+    m_rules = rules;
+    m_uses = uses;
+    m_shared_uses = shared_uses;
+    m_error.clear();
+    return true;
+}
+
+double Rules::binary(op code, double a, double b)
+{
+    switch (code)
+    {
+    case op::add:
+        return a + b;
+    case op::sub:
+        return a - b;
+    case op::mul:
+        return a * b;
+    case op::div:
+        return a / b;
+    case op::mod:
+        return std::fmod(a, b);
+    case op::lt:
+        return a < b;
+    case op::le:
+        return a <= b;
+    case op::gt:
+        return a > b;
+    case op::ge:
+        return a >= b;
+    case op::eq:
+        return a == b;
+    case op::ne:
+        return a != b;
+    case op::logical_and:
+        return a != 0. && b != 0.;
+    case op::logical_or:
+        return a != 0. || b != 0.;
+    default:
+        break;
+    }
+
+    return 0.;
+}
+
+unsigned Rules::run(const Inputs& inputs) const
+{
+    return timed(inputs) | execute(m_shared, inputs) | execute(m_zone, inputs);
+}
+
+unsigned Rules::timed(const Inputs& inputs) const
+{
+    if (m_week.empty())
+        return 0;
+
+    const auto minute = inputs[input::minute];
+    const auto hour = inputs[input::hour];
+    const auto dow = inputs[input::dow];
+    const auto index = static_cast<int>(dow * 24 * 60 + hour * 60 + minute);
+
+    // anything but a whole minute of the week is not in the table
+    if (minute >= 0 && minute < 60 && hour >= 0 && hour < 24 && dow >= 0 && dow < 7 &&
+        index == dow * 24 * 60 + hour * 60 + minute)
+        return m_week[index];
+
+    return execute(m_timed, inputs);
+}
+
+unsigned Rules::execute(const std::vector<Instruction>& code, const Inputs& inputs)
+{
+    std::array<double, MAX_STACK> stack;
+    auto top = stack.data() - 1;
+    unsigned flags = 0;
+
+    // every operator spelled out, so each is a single jump and no call
+    for (const auto& i : code)
+    {
+        switch (i.code)
+        {
+        case op::constant:
+            *++top = i.value;
+            break;
+        case op::load:
+            *++top = inputs[i.arg];
+            break;
+        case op::neg:
+            *top = -*top;
+            break;
+        case op::logical_not:
+            *top = *top == 0.;
+            break;
+        case op::add:
+            --top;
+            top[0] = top[0] + top[1];
+            break;
+        case op::sub:
+            --top;
+            top[0] = top[0] - top[1];
+            break;
+        case op::mul:
+            --top;
+            top[0] = top[0] * top[1];
+            break;
+        case op::div:
+            --top;
+            top[0] = top[0] / top[1];
+            break;
+        case op::mod:
+            --top;
+            top[0] = std::fmod(top[0], top[1]);
+            break;
+        case op::lt:
+            --top;
+            top[0] = top[0] < top[1];
+            break;
+        case op::le:
+            --top;
+            top[0] = top[0] <= top[1];
+            break;
+        case op::gt:
+            --top;
+            top[0] = top[0] > top[1];
+            break;
+        case op::ge:
+            --top;
+            top[0] = top[0] >= top[1];
+            break;
+        case op::eq:
+            --top;
+            top[0] = top[0] == top[1];
+            break;
+        case op::ne:
+            --top;
+            top[0] = top[0] != top[1];
+            break;
+        case op::logical_and:
+            --top;
+            top[0] = top[0] != 0. && top[1] != 0.;
+            break;
+        case op::logical_or:
+            --top;
+            top[0] = top[0] != 0. || top[1] != 0.;
+            break;
+        case op::act:
+            flags |= (*top-- != 0.) ? i.arg : 0u;
+            break;
+        }
+    }
+
+    return flags;
+}
+
+void Rules::apply(ZoneController& zones, Inputs& inputs)
+{
+    // the shared rules only run again when one of their inputs changed
+    auto changed = !m_cached;
+    for (unsigned i = 0; i < input::count; ++i)
+    {
+        if ((m_shared_uses & (1u << i)) && inputs[i] != m_last[i])
+            changed = true;
+    }
+
+    if (changed)
+    {
+        m_last = inputs;
+        m_shared_flags = execute(m_shared, inputs);
+        m_cached = true;
+    }
+
+    const auto common = m_shared_flags | timed(inputs);
+    for (size_t zone = 0; zone < zones.size(); ++zone)
+    {
+        auto flags = common;
+        if (!m_zone.empty())
+        {
+            inputs[input::inside] = zones.current(zone).celsius();
+            inputs[input::target] = zones.target(zone).celsius();
+            inputs[input::status] = static_cast<double>(zones.current_status(zone));
+            inputs[input::mode] = static_cast<double>(zones.get_mode(zone));
+            flags |= execute(m_zone, inputs);
+        }
+        zones.set_policy(zone, flags);
+    }
+}
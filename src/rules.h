@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef RULES_H
+#define RULES_H
+
+#include "zones.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Site specific control policies.
+ *
+ * One rule per line, or separated by ';', with '#' comments:
+ *
+ *     # fan on for 10 minutes every hour
+ *     when minute < 10 then fan
+ *     # no cooling when it is cool outside
+ *     when outside < 15 then lockout cool
+ *     when dow == 0 and status == heating then lockout cool, fan
+ *
+ * Conditions use + - * / %, comparisons, and, or, not and parentheses over
+ * numbers and the inputs: inside, target and outside in Celsius, minute,
+ * hour, dow (0 is Sunday), status (idle, cooling, heating) and mode (off,
+ * auto, cool, heat).  Actions are fan, lockout heat and lockout cool, see
+ * ZoneController::policy.
+ *
+ * The text is compiled once into flat postfix programs with every name
+ * resolved, each run as a single pass on a fixed size stack.  Rules are
+ * split by what they read so most cost nothing per evaluation:
+ *  - Rules of the time alone are run for every minute of the week at
+ *    compile time, and become a table lookup.
+ *  - Other rules that read no per zone input are run once per evaluation
+ *    at most, and by apply() only when one of their inputs changed.
+ *  - The rest run for every zone.
+ */
+class Rules
+{
+public:
+
+    /// Indexes of Inputs.
+    struct input
+    {
+        enum : uint8_t
+        {
+            inside,
+            target,
+            outside,
+            minute,
+            hour,
+            dow,
+            status,
+            mode,
+            count,
+        };
+    };
+
+    using Inputs = std::array<double, input::count>;
+
+    /// Inputs taken from the wall clock, as a mask of 1 << input.
+    static constexpr unsigned TIME_INPUTS =
+        (1u << input::minute) | (1u << input::hour) | (1u << input::dow);
+
+    /// Inputs that differ from zone to zone, as a mask of 1 << input.
+    static constexpr unsigned ZONE_INPUTS =
+        (1u << input::inside) | (1u << input::target) |
+        (1u << input::status) | (1u << input::mode);
+
+    static constexpr int WEEK_MINUTES = 7 * 24 * 60;
+
+    /// Deepest expression a program may need.
+    static constexpr size_t MAX_STACK = 32;
+
+    /**
+     * Compile rules, replacing the current ones only on success.
+     *
+     * On error the reason is available from error().
+     */
+    bool compile(const std::string& source);
+
+    inline const std::string& error() const { return m_error; }
+
+    inline bool empty() const { return m_rules == 0; }
+
+    /// Number of rules.
+    inline size_t size() const { return m_rules; }
+
+    /// Length of the compiled program.
+    inline size_t instructions() const { return m_timed.size() + m_shared.size() + m_zone.size(); }
+
+    /// Inputs read by any rule, as a mask of 1 << input.
+    inline unsigned uses() const { return m_uses; }
+
+    /// Run every rule.  Returns the ZoneController::policy flags of those that hold.
+    unsigned run(const Inputs& inputs) const;
+
+    /**
+     * Run the rules for every zone and set its policy.
+     *
+     * The per zone inputs are filled in from the controller, the others
+     * are taken as given.
+     */
+    void apply(ZoneController& zones, Inputs& inputs);
+
+protected:
+
+    enum class op : uint8_t
+    {
+        constant,
+        load,
+        neg,
+        logical_not,
+        add,
+        sub,
+        mul,
+        div,
+        mod,
+        lt,
+        le,
+        gt,
+        ge,
+        eq,
+        ne,
+        logical_and,
+        logical_or,
+        act,
+    };
+
+    struct Instruction
+    {
+        op code;
+        /// input index for load, policy flags for act
+        uint8_t arg;
+        double value;
+    };
+
+    /// Apply a binary operator, also used to fold constants.
+    static double binary(op code, double a, double b);
+
+    static unsigned execute(const std::vector<Instruction>& code, const Inputs& inputs);
+
+    /// Result of the time only rules.
+    unsigned timed(const Inputs& inputs) const;
+
+    /// rules that read the time alone, and their result by minute of the week
+    std::vector<Instruction> m_timed;
+    std::vector<uint8_t> m_week;
+    /// other rules that read no per zone input
+    std::vector<Instruction> m_shared;
+    std::vector<Instruction> m_zone;
+    unsigned m_shared_uses{0};
+    /// inputs and result of the last run of m_shared by apply()
+    Inputs m_last{};
+    unsigned m_shared_flags{0};
+    bool m_cached{false};
+    size_t m_rules{0};
+    unsigned m_uses{0};
+    std::string m_error;
+
+    friend class RuleCompiler;
+};
+
+#endif
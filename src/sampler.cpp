@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "sampler.h"
+#include <egt/app.h>
+#include <egt/asio.hpp>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+using namespace std;
+
+struct SensorSampler::watch_impl
+{
+    explicit watch_impl(int fd)
+        : input(egt::Application::instance().event().io(), fd)
+    {}
+
+    asio::posix::stream_descriptor input;
+};
+
+SensorSampler::SensorSampler(std::chrono::milliseconds period)
+    : m_period(period),
+      m_event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      m_watch(std::make_unique<watch_impl>(::dup(m_event_fd)))
+{
+}
+
+void SensorSampler::select(const std::string& name)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_name = name;
+        ++m_request;
+    }
+    m_cv.notify_one();
+}
+
+void SensorSampler::filter(const SampleFilter::Config& config)
+{
+    m_filter = SampleFilter(config);
+}
+
+bool SensorSampler::record(const std::string& path)
+{
+    return m_recorder.open(path);
+}
+
+void SensorSampler::adaptive(const Adaptive& adaptive)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_adaptive = adaptive;
+    m_adaptive.max_period = std::max(m_adaptive.max_period, m_period);
+}
+
+void SensorSampler::threshold(double value)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_threshold = value;
+    m_have_threshold = true;
+}
+
+void SensorSampler::boost()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_boost;
+    }
+    ++m_stats.boosts;
+    m_cv.notify_one();
+}
+
+void SensorSampler::on_sample(sample_callback_t callback)
+{
+    m_callback = std::move(callback);
+}
+
+void SensorSampler::start()
+{
+    if (m_thread.joinable())
+        return;
+
+    m_stop = false;
+    m_thread = std::thread(&SensorSampler::run, this);
+    arm();
+}
+
+void SensorSampler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+
+    if (m_thread.joinable())
+        m_thread.join();
+
+    m_watch->input.cancel();
+}
+
+void SensorSampler::run()
+{
+    auto& registry = sensor_registry();
+    SensorHandle handle;
+    unsigned int request = 0;
+    unsigned int boost = 0;
+    auto interval = m_period;
+    double last = 0.;
+    bool have_last = false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop)
+    {
+        if (request != m_request)
+        {
+            request = m_request;
+            const auto name = m_name;
+            lock.unlock();
+            handle = registry.resolve(name);
+            m_filter.reset();
+            have_last = false;
+            lock.lock();
+            continue;
+        }
+
+        // nothing to poll, for example while an IIO device is selected
+        if (!handle.valid())
+        {
+            m_cv.wait(lock, [this, request]()
+            {
+                return m_stop || request != m_request;
+            });
+            ++m_stats.wakeups;
+            continue;
+        }
+
+        const auto threshold = m_threshold;
+        const auto have_threshold = m_have_threshold;
+        const auto adaptive = m_adaptive;
+        boost = m_boost;
+        lock.unlock();
+
+        Sample sample;
+        const auto unpaced = registry.unpaced(handle);
+        m_unpaced = unpaced;
+        const auto begin = std::chrono::steady_clock::now();
+        if (registry.read(handle, sample.value))
+            sample.q = Sample::quality::good;
+        else
+            ++m_stats.errors;
+        sample.time = std::chrono::steady_clock::now();
+
+        const long long latency =
+            std::chrono::duration_cast<std::chrono::microseconds>(sample.time - begin).count();
+        ++m_stats.reads;
+        m_stats.last_latency_us = latency;
+        m_stats.total_latency_us += latency;
+        if (latency > m_stats.max_latency_us)
+            m_stats.max_latency_us = latency;
+
+        if (m_recorder.is_open())
+            m_recorder.append(sample.time, sample.value, static_cast<uint32_t>(sample.q));
+
+        // poll fast while the reading moves or sits near the switching
+        // point, otherwise back off exponentially
+        const auto raw = sample.value;
+        const auto good = sample.q == Sample::quality::good;
+        if (!good ||
+            !have_last ||
+            std::fabs(raw - last) >= adaptive.motion ||
+            (have_threshold && std::fabs(raw - threshold) <= adaptive.near))
+            interval = m_period;
+        else
+            interval = std::min(interval * 2, adaptive.max_period);
+        last = raw;
+        have_last = good;
+        m_stats.interval_ms = interval.count();
+
+        if (m_filter.process(sample) != SampleFilter::result::hold)
+        {
+            auto queued = m_ring.push(sample);
+            if (!queued && unpaced)
+            {
+                // an unpaced replay loses nothing, it waits for the UI thread
+                lock.lock();
+                m_cv.wait(lock, [this, request, &sample, &queued]()
+                {
+                    return m_stop || request != m_request || (queued = m_ring.push(sample));
+                });
+                lock.unlock();
+            }
+
+            if (queued)
+            {
+                const uint64_t one = 1;
+                if (::write(m_event_fd, &one, sizeof(one)) < 0)
+                {
+                    // eventfd counter saturated; the UI thread will drain anyway
+                }
+            }
+            else
+            {
+                ++m_stats.overruns;
+            }
+        }
+
+        lock.lock();
+        // a replay that is not paced reads again at once, still taking stop
+        // and select requests in between
+        auto deadline = unpaced ? sample.time : sample.time + interval;
+        while (!m_stop && request == m_request)
+        {
+            if (boost != m_boost)
+            {
+                boost = m_boost;
+                interval = m_period;
+                deadline = std::min(deadline, sample.time + interval);
+                m_stats.interval_ms = interval.count();
+            }
+
+            const auto status = m_cv.wait_until(lock, deadline);
+            ++m_stats.wakeups;
+            if (status == std::cv_status::timeout)
+                break;
+        }
+    }
+}
+
+void SensorSampler::arm()
+{
+    m_watch->input.async_wait(asio::posix::stream_descriptor::wait_read,
+                              [this](const asio::error_code & error)
+    {
+        if (error)
+            return;
+
+        drain();
+        arm();
+    });
+}
+
+void SensorSampler::drain()
+{
+    uint64_t count;
+    if (::read(m_event_fd, &count, sizeof(count)) < 0)
+    {
+        // nothing pending
+    }
+
+    // only what the filter let through is queued, faults included
+    Sample latest;
+    bool have = false;
+    Sample sample;
+    const bool unpaced = m_unpaced;
+    if (unpaced)
+    {
+        // every sample in order, a ring at a time so the event loop keeps
+        // running while the replay refills it
+        for (size_t i = 0; i < m_ring.capacity() && m_ring.pop(sample); ++i)
+        {
+            ++m_stats.delivered;
+            if (m_callback)
+                m_callback(sample);
+        }
+    }
+    else
+    {
+        while (m_ring.pop(sample))
+        {
+            ++m_stats.delivered;
+            latest = sample;
+            have = true;
+        }
+    }
+
+    if (unpaced)
+    {
+        // the sampling thread may wait for room, and checks for it under
+        // the lock
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_cv.notify_one();
+    }
+
+    if (!m_ring.empty())
+    {
+        const uint64_t one = 1;
+        if (::write(m_event_fd, &one, sizeof(one)) < 0)
+        {
+            // already readable
+        }
+    }
+
+    if (have && m_callback)
+        m_callback(latest);
+}
+
+SensorSampler::~SensorSampler()
+{
+    stop();
+    m_watch.reset();
+    if (m_event_fd >= 0)
+        ::close(m_event_fd);
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "filter.h"
+#include "sensors.h"
+#include "trace.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Bounded lock-free single-producer/single-consumer ring.
+ *
+ * One thread may call push() and one other thread may call pop(). N must be a
+ * power of two.
+ */
+template<class T, std::size_t N>
+class SpscRing
+{
+    static_assert(N && !(N & (N - 1)), "N must be a power of two");
+
+public:
+
+    bool push(const T& value)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == N)
+            return false;
+        m_buffer[head & (N - 1)] = value;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value)
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+            return false;
+        value = m_buffer[tail & (N - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline bool empty() const
+    {
+        return m_tail.load(std::memory_order_acquire) ==
+               m_head.load(std::memory_order_acquire);
+    }
+
+    static constexpr std::size_t capacity() { return N; }
+
+protected:
+
+    std::array<T, N> m_buffer{};
+    alignas(64) std::atomic<std::size_t> m_head{0};
+    alignas(64) std::atomic<std::size_t> m_tail{0};
+};
+
+struct Sample
+{
+    enum class quality
+    {
+        good,
+        error,
+        fault,
+    };
+
+    double value{0.};
+    std::chrono::steady_clock::time_point time;
+    quality q{quality::error};
+};
+
+/**
+ * Reads the selected temperature sensor on a dedicated thread.
+ *
+ * Samples are handed to the UI thread through an SpscRing and an eventfd
+ * watched by the EGT event loop, so the UI thread never blocks on sensor I/O.
+ * Samples held back by the SampleFilter never wake the UI thread.
+ *
+ * A trace replayed unpaced waits for room in the ring instead of dropping
+ * samples, and every one of them reaches the UI thread in order, so a
+ * replay gives the same result every time.
+ *
+ * The polling interval adapts: it stays at the base period while the reading
+ * moves or is near the switching threshold, and doubles on every quiet sample
+ * up to a maximum.  boost() drops back to the base period at once.
+ */
+class SensorSampler
+{
+public:
+
+    struct Stats
+    {
+        std::atomic<unsigned long> reads{0};
+        std::atomic<unsigned long> errors{0};
+        std::atomic<unsigned long> overruns{0};
+        std::atomic<unsigned long> delivered{0};
+        std::atomic<long long> last_latency_us{0};
+        std::atomic<long long> max_latency_us{0};
+        std::atomic<long long> total_latency_us{0};
+        /// times the sampling thread woke up
+        std::atomic<unsigned long> wakeups{0};
+        std::atomic<unsigned long> boosts{0};
+        /// current polling interval
+        std::atomic<long long> interval_ms{0};
+    };
+
+    struct Adaptive
+    {
+        /// longest polling interval in steady state
+        std::chrono::milliseconds max_period{std::chrono::seconds(32)};
+        /// change between reads, in Celsius, that counts as moving
+        double motion{0.1};
+        /// distance from the threshold, in Celsius, that counts as near
+        double near{1.};
+    };
+
+    using sample_callback_t = std::function<void(const Sample&)>;
+
+    explicit SensorSampler(std::chrono::milliseconds period = std::chrono::seconds(1));
+
+    /// Select the sensor to sample by name.  Safe to call from the UI thread.
+    void select(const std::string& name);
+
+    void adaptive(const Adaptive& adaptive);
+
+    /// Set the temperature, in Celsius, at which the control logic switches.
+    void threshold(double value);
+
+    /// Return to fast polling, for example on user input or a mode change.
+    void boost();
+
+    /// Filter samples before they are queued.  Call before start().
+    void filter(const SampleFilter::Config& config);
+
+    inline const SampleFilter::Stats& filter_stats() const { return m_filter.stats(); }
+
+    /// Append every sample to a trace file.  Call before start().
+    bool record(const std::string& path);
+
+    /**
+     * Called on the UI thread with the latest sample after each drain, or
+     * with every sample of an unpaced replay.  A sample that is not good
+     * means the sensor has failed.
+     */
+    void on_sample(sample_callback_t callback);
+
+    void start();
+
+    void stop();
+
+    inline const Stats& stats() const { return m_stats; }
+
+    virtual ~SensorSampler();
+
+protected:
+
+    void run();
+    void arm();
+    void drain();
+
+    std::chrono::milliseconds m_period;
+    SpscRing<Sample, 16> m_ring;
+    Stats m_stats;
+    TraceRecorder m_recorder;
+    SampleFilter m_filter;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::string m_name;
+    unsigned int m_request{0};
+    unsigned int m_boost{0};
+    double m_threshold{0.};
+    bool m_have_threshold{false};
+    Adaptive m_adaptive;
+    bool m_stop{false};
+    /// the sensor is an unpaced replay, set by the sampling thread
+    std::atomic<bool> m_unpaced{false};
+
+    std::thread m_thread;
+    int m_event_fd{-1};
+
+    struct watch_impl;
+    std::unique_ptr<watch_impl> m_watch;
+    sample_callback_t m_callback;
+};
+
+#endif
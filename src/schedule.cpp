@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "schedule.h"
+#include <algorithm>
+
+void Schedule::compile(std::vector<Transition> transitions)
+{
+    m_table.clear();
+
+    for (auto& t : transitions)
+    {
+        if (t.dow < 0 || t.dow > 6 || t.minute < 0 || t.minute >= DAY_MINUTES)
+            continue;
+
+        t.minute -= t.minute % SLOT_MINUTES;
+        m_table.push_back(t);
+    }
+
+    std::stable_sort(m_table.begin(), m_table.end(),
+                     [](const Transition & a, const Transition & b)
+    {
+        return a.week_minute() < b.week_minute();
+    });
+
+    // keep the last of any transitions sharing a slot
+    auto last = std::unique(m_table.rbegin(), m_table.rend(),
+                            [](const Transition & a, const Transition & b)
+    {
+        return a.week_minute() == b.week_minute();
+    });
+    m_table.erase(m_table.begin(), last.base());
+
+    if (m_table.empty())
+        return;
+
+    // slots before the first transition of the week are still in the last one
+    size_t index = m_table.size() - 1;
+    size_t next = 0;
+    for (int slot = 0; slot < SLOTS; ++slot)
+    {
+        while (next < m_table.size() &&
+               m_table[next].week_minute() / SLOT_MINUTES <= slot)
+            index = next++;
+        m_slot[slot] = static_cast<uint16_t>(index);
+    }
+}
+
+int Schedule::until_next(int week_minute) const
+{
+    const auto next = (active(week_minute) + 1) % m_table.size();
+    auto delta = m_table[next].week_minute() - week_minute;
+    if (delta <= 0)
+        delta += WEEK_MINUTES;
+    return delta;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "temperature.h"
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+/**
+ * Weekly program compiled into a sorted transition table.
+ *
+ * Transitions are quantized to SLOT_MINUTES. Every slot of the week maps
+ * to the transition in effect, so finding the current target and the time
+ * to the next transition are both constant time.
+ */
+class Schedule
+{
+public:
+
+    static constexpr int SLOT_MINUTES = 15;
+    static constexpr int DAY_MINUTES = 24 * 60;
+    static constexpr int WEEK_MINUTES = 7 * DAY_MINUTES;
+    static constexpr int SLOTS = WEEK_MINUTES / SLOT_MINUTES;
+
+    struct Transition
+    {
+        /// day of the week, 0 is Sunday like tm_wday
+        int dow{0};
+        /// minute of the day
+        int minute{0};
+        Temperature target;
+
+        inline int week_minute() const { return dow * DAY_MINUTES + minute; }
+    };
+
+    /// Build the table, dropping invalid entries.  Later duplicates win.
+    void compile(std::vector<Transition> transitions);
+
+    inline bool empty() const { return m_table.empty(); }
+
+    inline const std::vector<Transition>& transitions() const { return m_table; }
+
+    /// Index into transitions() of the one in effect at a minute of the week.
+    inline size_t active(int week_minute) const
+    {
+        return m_slot[week_minute / SLOT_MINUTES];
+    }
+
+    /// Minutes from a minute of the week to the next transition, in (0, WEEK_MINUTES].
+    int until_next(int week_minute) const;
+
+    /// Minute of the week of a local time.
+    static inline int week_minute(const std::tm& tm)
+    {
+        return tm.tm_wday * DAY_MINUTES + tm.tm_hour * 60 + tm.tm_min;
+    }
+
+protected:
+
+    std::vector<Transition> m_table;
+    std::array<uint16_t, SLOTS> m_slot{};
+};
+
+#endif
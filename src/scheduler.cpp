@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "logic.h"
+#include "scheduler.h"
+#include "settings.h"
+#include <cerrno>
+#include <egt/app.h>
+#include <egt/asio.hpp>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+struct ScheduleEngine::watch_impl
+{
+    watch_impl()
+        : input(egt::Application::instance().event().io())
+    {}
+
+    asio::posix::stream_descriptor input;
+    bool waiting{false};
+};
+
+ScheduleEngine::ScheduleEngine(Logic& logic)
+    : m_logic(logic),
+      m_watch(std::make_unique<watch_impl>())
+{
+    m_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_fd >= 0)
+    {
+        asio::error_code ec;
+        m_watch->input.assign(m_fd, ec);
+    }
+
+    reload();
+
+    // a mode or status change, which updates the model, moves the time
+    // recovery has to start, and so does a sample, but only if it moves it
+    // by a minute or more
+    m_logic.on_change([this](unsigned changed)
+    {
+        if (changed & (Logic::dirty::mode | Logic::dirty::status))
+            reschedule();
+        else if ((changed & Logic::dirty::current) && m_pending >= 0 &&
+                 recovery(m_schedule.transitions()[m_pending].target) != m_lead)
+            reschedule();
+    });
+}
+
+void ScheduleEngine::reload()
+{
+    m_enabled = settings().flag<setting::schedule_enabled>();
+    m_recovery_max = std::chrono::minutes(settings().integer<setting::recovery_max>());
+    m_schedule.compile(settings().load_schedule());
+    m_applied = -1;
+
+    reschedule();
+}
+
+void ScheduleEngine::reschedule()
+{
+    m_pending = -1;
+    if (m_fd < 0)
+        return;
+
+    itimerspec spec{};
+
+    if (m_enabled && !m_schedule.empty())
+    {
+        // pick up any change to TZ or the zone file
+        tzset();
+
+        const auto now = std::time(nullptr);
+        std::tm tm{};
+        localtime_r(&now, &tm);
+        const auto week_minute = Schedule::week_minute(tm);
+
+        const auto& table = m_schedule.transitions();
+        const auto index = m_schedule.active(week_minute);
+        const auto next = (index + 1) % table.size();
+        const auto until = m_schedule.until_next(week_minute);
+
+        // start early so the next target is reached at the transition
+        auto apply = index;
+        auto wait = until;
+        if (next != index)
+        {
+            if (static_cast<long>(next) == m_applied)
+                apply = next;
+            else
+            {
+                const auto lead = recovery(table[next].target);
+                if (lead >= until)
+                    apply = next;
+                else
+                {
+                    wait = until - lead;
+                    m_pending = next;
+                    m_lead = lead;
+                }
+            }
+        }
+
+        if (static_cast<long>(apply) != m_applied)
+        {
+            m_applied = apply;
+            m_logic.change_target(table[apply].target);
+        }
+
+        // add wall clock minutes and let mktime() resolve the DST offset
+        tm.tm_sec = 0;
+        tm.tm_min += wait;
+        tm.tm_isdst = -1;
+        auto deadline = std::mktime(&tm);
+
+        // the repeated hour when DST ends can resolve to the past
+        if (deadline <= now)
+            deadline = now + 60;
+
+        spec.it_value.tv_sec = deadline;
+    }
+
+    timerfd_settime(m_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, nullptr);
+
+    if (spec.it_value.tv_sec)
+        arm();
+}
+
+int ScheduleEngine::recovery(Temperature target) const
+{
+    if (!m_recovery_max.count() || !m_logic.sampled() || !m_logic.current_valid())
+        return 0;
+
+    const auto mode = m_logic.get_mode();
+    return m_logic.model().early_start(m_logic.current().celsius(), target.celsius(),
+                                       m_logic.outside().celsius(),
+                                       m_logic.control().deadband.celsius(),
+                                       mode == Logic::mode::automatic || mode == Logic::mode::heating,
+                                       mode == Logic::mode::automatic || mode == Logic::mode::cooling,
+                                       m_recovery_max.count());
+}
+
+void ScheduleEngine::arm()
+{
+    if (m_watch->waiting)
+        return;
+
+    m_watch->waiting = true;
+    m_watch->input.async_wait(asio::posix::stream_descriptor::wait_read,
+                              [this](const asio::error_code & error)
+    {
+        m_watch->waiting = false;
+        if (error)
+            return;
+
+        expired();
+    });
+}
+
+void ScheduleEngine::expired()
+{
+    // ECANCELED here means the clock was set, which needs the same handling
+    uint64_t count;
+    if (::read(m_fd, &count, sizeof(count)) < 0 && errno == EAGAIN)
+    {
+        arm();
+        return;
+    }
+
+    reschedule();
+}
+
+ScheduleEngine::~ScheduleEngine()
+{
+    if (m_fd >= 0)
+    {
+        m_watch->input.cancel();
+        m_watch->input.release();
+        ::close(m_fd);
+    }
+}
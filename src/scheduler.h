@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "schedule.h"
+#include <chrono>
+#include <memory>
+
+class Logic;
+
+/**
+ * Applies a Schedule to Logic.
+ *
+ * A single one-shot timer is armed for the wall clock time of the next
+ * transition; nothing polls.  The deadline is computed from local time with
+ * mktime(), so DST shifts land on the right wall clock minute.  If the clock
+ * is set, the kernel cancels the timer and only the next deadline is
+ * recomputed.  The target is only changed when the transition in effect
+ * changes, so a manual setpoint holds until the next transition.
+ *
+ * With adaptive recovery the next target is applied early, by as long as
+ * the learned ThermalModel says the HVAC needs to reach it on time.  A
+ * sample only rearms the timer if it moves the early start by a minute.
+ */
+class ScheduleEngine
+{
+public:
+
+    explicit ScheduleEngine(Logic& logic);
+
+    ScheduleEngine(const ScheduleEngine&) = delete;
+    ScheduleEngine& operator=(const ScheduleEngine&) = delete;
+
+    /// Load the program and the enabled flag from settings.
+    void reload();
+
+    /// Recompute the next deadline, for example after a timezone change.
+    void reschedule();
+
+    inline bool enabled() const { return m_enabled; }
+
+    inline const Schedule& schedule() const { return m_schedule; }
+
+    virtual ~ScheduleEngine();
+
+protected:
+
+    void arm();
+    void expired();
+
+    /// Minutes needed to reach a target from the current temperature.
+    int recovery(Temperature target) const;
+
+    Logic& m_logic;
+    Schedule m_schedule;
+    bool m_enabled{false};
+    /// longest early start, 0 disables adaptive recovery
+    std::chrono::minutes m_recovery_max{0};
+    /// transition last applied to Logic, -1 for none
+    long m_applied{-1};
+    /// transition waiting to start early, -1 for none, and the minutes early
+    long m_pending{-1};
+    int m_lead{0};
+    int m_fd{-1};
+
+    struct watch_impl;
+    std::unique_ptr<watch_impl> m_watch;
+};
+
+#endif
@@ -8,138 +8,537 @@
 #endif
 
 #include "sensors.h"
-#include <egt/detail/math.h>
-#include <egt/geometry.h>
-#include <iostream>
+#include "iio.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <egt/app.h>
+#include <egt/asio.hpp>
+#include <egt/timer.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <iterator>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <tuple>
+#include <unistd.h>
 
 #ifdef HAVE_SENSORS
 #include <sensors/sensors.h>
 #else
-#warning "libsensors not found.  Can't read sensors."
+#warning "libsensors not found.  Only hwmon sensors available."
 #endif
 
 using namespace std;
+namespace fs = std::filesystem;
 
-static void init_sensors()
+static const char HWMON_PREFIX[] = "hwmon:";
+static const char ROOM_PREFIX[] = "room:";
+static const char TRACE_PREFIX[] = "trace:";
+
+/// Rescan period when kernel uevents can't be received.
+static constexpr auto RESCAN_PERIOD = std::chrono::seconds(10);
+
+HwmonSensors::HwmonSensors(const std::string& root)
+    : m_root(root)
+{
+    scan();
+}
+
+bool HwmonSensors::scan()
+{
+    std::vector<std::pair<std::string, fs::path>> found;
+
+    std::error_code ec;
+    if (fs::is_directory(m_root, ec))
+    {
+        for (const auto& dev : fs::directory_iterator(m_root, ec))
+        {
+            for (const auto& attr : fs::directory_iterator(dev.path(), ec))
+            {
+                const auto file = attr.path().filename().string();
+                const std::string suffix = "_input";
+                if (file.compare(0, 4, "temp") != 0 ||
+                    file.size() <= suffix.size() ||
+                    file.compare(file.size() - suffix.size(), suffix.size(), suffix) != 0)
+                    continue;
+
+                found.emplace_back(HWMON_PREFIX + dev.path().filename().string() + "/" +
+                                   file.substr(0, file.size() - suffix.size()), attr.path());
+            }
+        }
+    }
+
+    std::sort(found.begin(), found.end());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // channel indexes stay stable, vanished channels are only closed
+    bool changed = false;
+    for (auto& channel : m_channels)
+    {
+        const auto i = std::lower_bound(found.begin(), found.end(), channel.name,
+                                        [](const std::pair<std::string, fs::path>& f,
+                                           const std::string & name) { return f.first < name; });
+        if (i == found.end() || i->first != channel.name)
+        {
+            if (channel.fd >= 0)
+            {
+                ::close(channel.fd);
+                channel.fd = -1;
+                changed = true;
+            }
+        }
+    }
+
+    for (const auto& f : found)
+    {
+        auto channel = std::find_if(m_channels.begin(), m_channels.end(),
+                                    [&f](const Channel & c) { return c.name == f.first; });
+        if (channel != m_channels.end() && channel->fd >= 0)
+            continue;
+
+        const int fd = ::open(f.second.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        if (channel != m_channels.end())
+            channel->fd = fd;
+        else
+            m_channels.push_back({f.first, fd});
+        changed = true;
+    }
+
+    return changed;
+}
+
+int HwmonSensors::find(const std::string& name) const
 {
-    static bool i = false;
-    if (!i)
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_channels.size(); ++i)
+        if (m_channels[i].name == name)
+            return static_cast<int>(i);
+    return -1;
+}
+
+/*
+ * hwmon temperatures are integer millidegrees Celsius followed by a newline.
+ */
+static bool parse_millidegrees(const char* buf, ssize_t len, double& value)
+{
+    ssize_t i = 0;
+    bool negative = false;
+    if (i < len && buf[i] == '-')
     {
+        negative = true;
+        ++i;
+    }
+
+    if (i >= len || buf[i] < '0' || buf[i] > '9')
+        return false;
+
+    long v = 0;
+    for (; i < len && buf[i] >= '0' && buf[i] <= '9'; ++i)
+        v = v * 10 + (buf[i] - '0');
+
+    value = (negative ? -v : v) / 1000.;
+    return true;
+}
+
+bool HwmonSensors::available(size_t index) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return index < m_channels.size() && m_channels[index].fd >= 0;
+}
+
+bool HwmonSensors::read(size_t index, double& value) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return read_locked(index, value);
+}
+
+bool HwmonSensors::read_locked(size_t index, double& value) const
+{
+    if (index >= m_channels.size() || m_channels[index].fd < 0)
+        return false;
+
+    char buf[32];
+    const auto len = ::pread(m_channels[index].fd, buf, sizeof(buf), 0);
+    if (len <= 0)
+        return false;
+
+    return parse_millidegrees(buf, len, value);
+}
+
+size_t HwmonSensors::read_all(double* values, size_t count) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t n = 0;
+    for (size_t i = 0; i < m_channels.size() && i < count; ++i)
+        if (read_locked(i, values[i]))
+            ++n;
+    return n;
+}
+
+HwmonSensors::~HwmonSensors()
+{
+    for (auto& channel : m_channels)
+        if (channel.fd >= 0)
+            ::close(channel.fd);
+}
+
+SensorRegistry::SensorRegistry()
+{
 #ifdef HAVE_SENSORS
-        sensors_init(NULL);
+    sensors_init(NULL);
 #endif
-        i = true;
-    }
 }
 
-std::vector<std::string> enumerate_temp_sensors()
+SensorRegistry& sensor_registry()
 {
-    init_sensors();
+    static SensorRegistry registry;
+    return registry;
+}
 
-    std::vector<std::string> res;
+struct SensorCatalog::watch_impl
+{
+    explicit watch_impl(asio::io_context& io)
+        : input(io)
+    {}
+
+    asio::posix::stream_descriptor input;
+    egt::PeriodicTimer rescan{RESCAN_PERIOD};
+};
+
+SensorCatalog::SensorCatalog(SensorRegistry& registry)
+    : m_registry(registry)
+{
+}
+
+static std::vector<std::string> hwmon_names(const HwmonSensors& hwmon)
+{
+    std::vector<std::string> names;
+    for (size_t i = 0; i < hwmon.size(); ++i)
+        if (hwmon.available(i))
+            names.push_back(hwmon.name(i));
+    return names;
+}
+
+void SensorCatalog::build()
+{
+    m_names.clear();
 
     // add fake sensor
-    res.push_back("fake");
+    m_names.push_back("fake");
 
 #ifdef HAVE_SENSORS
+    // libsensors keeps its chip list from sensors_init(), only hwmon and IIO
+    // devices can come and go at runtime
     sensors_chip_name const* cn;
     int c = 0;
     while ((cn = sensors_get_detected_chips(0, &c)) != 0)
     {
-        std::cout << "Chip: " << cn->prefix << cn->path << std::endl;
-
         sensors_feature const* feat;
         int f = 0;
         while ((feat = sensors_get_features(cn, &f)) != 0)
         {
-            std::cout << f << ": " << feat->name << std::endl;
+            if (feat->type == SENSORS_FEATURE_TEMP)
+                m_names.push_back(std::string(cn->prefix) + std::string(cn->path) + "/" + std::to_string(f));
+        }
+    }
+#endif
 
-            switch (feat->type)
-            {
-            case SENSORS_FEATURE_TEMP:
-                res.push_back(std::string(cn->prefix) + std::string(cn->path) + "/" + std::to_string(f));
-                break;
-            default:
-                break;
-            }
+    m_fixed = m_names.size();
+    m_hwmon = hwmon_names(m_registry.hwmon());
+    m_iio = enumerate_iio_sensors();
+    m_names.insert(m_names.end(), m_hwmon.begin(), m_hwmon.end());
+    m_names.insert(m_names.end(), m_iio.begin(), m_iio.end());
+}
 
-            sensors_subfeature const* subf;
-            int s = 0;
-            while ((subf = sensors_get_all_subfeatures(cn, feat, &s)) != 0)
-            {
-                std::cout << f << ":" << s << ":" << subf->name
-                          << "/" << subf->number << " = ";
-                double val;
-                if (subf->flags & SENSORS_MODE_R)
-                {
-                    int rc = sensors_get_value(cn, subf->number, &val);
-                    if (rc < 0)
-                    {
-                        std::cout << "err: " << rc;
-                    }
-                    else
-                    {
-                        std::cout << val;
-                    }
-                }
-                std::cout << std::endl;
-            }
+void SensorCatalog::update(bool hwmon, bool iio)
+{
+    if (!m_built)
+        return;
+
+    auto changed = false;
+    if (hwmon && m_registry.hwmon().scan())
+    {
+        auto names = hwmon_names(m_registry.hwmon());
+        changed = names != m_hwmon;
+        m_hwmon.swap(names);
+    }
+
+    if (iio)
+    {
+        auto names = enumerate_iio_sensors();
+        if (names != m_iio)
+        {
+            changed = true;
+            m_iio.swap(names);
         }
     }
-#endif
 
-    return res;
+    if (!changed)
+        return;
+
+    m_names.resize(m_fixed);
+    m_names.insert(m_names.end(), m_hwmon.begin(), m_hwmon.end());
+    m_names.insert(m_names.end(), m_iio.begin(), m_iio.end());
+
+    on_change.invoke();
+}
+
+const std::vector<std::string>& SensorCatalog::sensors()
+{
+    if (!m_built)
+    {
+        build();
+        m_built = true;
+    }
+
+    return m_names;
+}
+
+void SensorCatalog::watch()
+{
+    if (m_watch)
+        return;
+
+    sensors();
+    m_watch = std::make_unique<watch_impl>(egt::Application::instance().event().io());
+
+    m_uevent = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        NETLINK_KOBJECT_UEVENT);
+    if (m_uevent >= 0)
+    {
+        // kernel uevents, not the ones relayed by udev
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = 1;
+        asio::error_code ec;
+        if (::bind(m_uevent, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+            m_watch->input.assign(m_uevent, ec);
+        if (ec || !m_watch->input.is_open())
+        {
+            ::close(m_uevent);
+            m_uevent = -1;
+        }
+    }
+
+    if (m_uevent >= 0)
+    {
+        arm();
+    }
+    else
+    {
+        m_watch->rescan.on_timeout([this]()
+        {
+            update(true, true);
+        });
+        m_watch->rescan.start();
+    }
+}
+
+void SensorCatalog::arm()
+{
+    m_watch->input.async_wait(asio::posix::stream_descriptor::wait_read,
+                              [this](const asio::error_code & error)
+    {
+        if (error)
+            return;
+
+        receive();
+        arm();
+    });
 }
 
-double get_temp_sensor(const std::string& name)
+void SensorCatalog::receive()
 {
-    init_sensors();
+    auto hwmon = false;
+    auto iio = false;
+
+    // "action@devpath" then KEY=value fields, each NUL terminated
+    char buf[8192];
+    ssize_t len;
+    while ((len = ::recv(m_uevent, buf, sizeof(buf) - 1, 0)) > 0)
+    {
+        buf[len] = 0;
+        for (auto field = buf; field < buf + len; field += std::strlen(field) + 1)
+        {
+            if (std::strcmp(field, "SUBSYSTEM=hwmon") == 0)
+                hwmon = true;
+            else if (std::strcmp(field, "SUBSYSTEM=iio") == 0)
+                iio = true;
+        }
+    }
+
+    if (hwmon || iio)
+        update(hwmon, iio);
+}
+
+void SensorCatalog::unwatch()
+{
+    if (!m_watch)
+        return;
+
+    if (m_uevent >= 0)
+    {
+        m_watch->input.cancel();
+        m_watch->input.release();
+        ::close(m_uevent);
+        m_uevent = -1;
+    }
+    m_watch.reset();
+}
+
+SensorCatalog::~SensorCatalog()
+{
+    unwatch();
+}
+
+SensorCatalog& sensor_catalog()
+{
+    static SensorCatalog catalog(sensor_registry());
+    return catalog;
+}
+
+std::vector<std::string> enumerate_temp_sensors()
+{
+    return sensor_catalog().sensors();
+}
+
+SensorHandle SensorRegistry::resolve(const std::string& name)
+{
+    SensorHandle handle;
 
     if (name == "fake")
     {
-        // Using an ellipse, increment the angle to find a point on the ellipse
-        // and then use the y coordinate as the temp. This gives some fake temp
-        // data that almost makes sense as we circle around the ellipse.
-        static unsigned int angle = 0;
-        egt::EllipseType<float> e(egt::PointType<float>(0.f, 20.f), 10.f, 3.f);
-        auto point = e.point_on_circumference(static_cast<float>(egt::detail::to_radians<float>(0,angle++)));
-        return point.y();
+        handle.type = SensorHandle::backend::room;
+        handle.number = 0;
+        room(0);
+        return handle;
     }
 
-    double res = 0.;
+    if (name.compare(0, sizeof(ROOM_PREFIX) - 1, ROOM_PREFIX) == 0)
+    {
+        char* end = nullptr;
+        const auto index = std::strtol(name.c_str() + sizeof(ROOM_PREFIX) - 1, &end, 10);
+        if (end && !*end && index >= 0 && index < 256)
+        {
+            handle.type = SensorHandle::backend::room;
+            handle.number = static_cast<int>(index);
+            room(index);
+        }
+        return handle;
+    }
+
+    if (name.compare(0, sizeof(HWMON_PREFIX) - 1, HWMON_PREFIX) == 0)
+    {
+        handle.number = m_hwmon.find(name);
+        if (handle.number >= 0)
+            handle.type = SensorHandle::backend::hwmon;
+        return handle;
+    }
+
+    if (name.compare(0, sizeof(TRACE_PREFIX) - 1, TRACE_PREFIX) == 0)
+    {
+        const auto path = name.substr(sizeof(TRACE_PREFIX) - 1);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto trace = std::find_if(m_traces.begin(), m_traces.end(),
+                                  [&path](const std::pair<std::string, TraceReplay>& t) { return t.first == path; });
+        if (trace == m_traces.end())
+        {
+            m_traces.emplace_back(std::piecewise_construct,
+                                  std::forward_as_tuple(path),
+                                  std::forward_as_tuple(path));
+            trace = std::prev(m_traces.end());
+        }
+
+        if (trace->second.is_open())
+        {
+            handle.type = SensorHandle::backend::trace;
+            handle.number = static_cast<int>(std::distance(m_traces.begin(), trace));
+        }
+        return handle;
+    }
 
 #ifdef HAVE_SENSORS
     sensors_chip_name const* cn;
     int c = 0;
     while ((cn = sensors_get_detected_chips(0, &c)) != 0)
     {
+        const std::string chip = std::string(cn->prefix) + std::string(cn->path) + "/";
+        if (name.compare(0, chip.size(), chip) != 0)
+            continue;
+
         sensors_feature const* feat;
         int f = 0;
         while ((feat = sensors_get_features(cn, &f)) != 0)
         {
-            switch (feat->type)
+            if (feat->type != SENSORS_FEATURE_TEMP ||
+                name.compare(chip.size(), std::string::npos, std::to_string(f)) != 0)
+                continue;
+
+            // @todo probably a good idea to check
+            // SENSORS_SUBFEATURE_TEMP_FAULT before reading the value as good
+
+            sensors_subfeature const* subf =
+                sensors_get_subfeature(cn, feat, SENSORS_SUBFEATURE_TEMP_INPUT);
+            if (subf)
             {
-            case SENSORS_FEATURE_TEMP:
-                if (name == std::string(cn->prefix) + std::string(cn->path) + "/" + std::to_string(f))
-                {
-                    // @todo probably a good idea to check
-                    // SENSORS_SUBFEATURE_TEMP_FAULT before reading the value as good
-
-                    sensors_subfeature const* subf =
-                        sensors_get_subfeature(cn, feat, SENSORS_SUBFEATURE_TEMP_INPUT);
-                    if (subf && sensors_get_value(cn, subf->number, &res) == 0)
-                    {
-                        return res;
-                    }
-                }
-
-                break;
-            default:
-                break;
+                handle.type = SensorHandle::backend::lmsensors;
+                handle.chip = cn;
+                handle.number = subf->number;
             }
+
+            return handle;
         }
     }
 #endif
 
-    return res;
+    return handle;
+}
+
+bool SensorRegistry::read(const SensorHandle& handle, double& value)
+{
+    switch (handle.type)
+    {
+    case SensorHandle::backend::room:
+        value = room(handle.number).sample();
+        return true;
+    case SensorHandle::backend::lmsensors:
+#ifdef HAVE_SENSORS
+        return sensors_get_value(handle.chip, handle.number, &value) == 0;
+#else
+        break;
+#endif
+    case SensorHandle::backend::hwmon:
+        return m_hwmon.read(handle.number, value);
+    case SensorHandle::backend::trace:
+    {
+        auto& trace = m_traces[handle.number].second;
+        trace.speed(m_trace_speed);
+        return trace.sample(std::chrono::steady_clock::now(), value);
+    }
+    case SensorHandle::backend::none:
+        break;
+    }
+
+    return false;
+}
+
+RoomModel& SensorRegistry::room(size_t index)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (m_rooms.size() <= index)
+        m_rooms.emplace_back();
+    return m_rooms[index];
+}
+
+SensorRegistry::~SensorRegistry()
+{
+#ifdef HAVE_SENSORS
+    sensors_cleanup();
+#endif
 }
@@ -6,11 +6,197 @@
 #ifndef SENSORS_H
 #define SENSORS_H
 
+#include "room.h"
+#include "trace.h"
+#include <atomic>
+#include <deque>
+#include <egt/signal.h>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 
-std::vector<std::string> enumerate_temp_sensors();
+struct sensors_chip_name;
+
+/**
+ * A temperature sensor resolved from its name.
+ *
+ * Resolving walks the detected chips once. Reading through the handle is then
+ * a single backend call with no lookups or allocations.
+ */
+struct SensorHandle
+{
+    enum class backend
+    {
+        none,
+        room,
+        lmsensors,
+        hwmon,
+        trace,
+    };
+
+    inline bool valid() const { return type != backend::none; }
+
+    backend type{backend::none};
+    const sensors_chip_name* chip{nullptr};
+    int number{-1};
+};
+
+/**
+ * Direct sysfs hwmon backend.
+ *
+ * Every temp*_input attribute under the hwmon class directory is found once
+ * and kept open, so a sample is a single pread() and an integer parse.
+ * Channel indexes never change across scans; a channel that disappears reads
+ * as an error until it comes back.
+ * Channels are named "hwmon:<device>/<attribute>", for example
+ * "hwmon:hwmon0/temp1".
+ */
+class HwmonSensors
+{
+public:
+
+    explicit HwmonSensors(const std::string& root = "/sys/class/hwmon");
+
+    HwmonSensors(const HwmonSensors&) = delete;
+    HwmonSensors& operator=(const HwmonSensors&) = delete;
+
+    /// Look for new or removed channels, returns true if anything changed.
+    bool scan();
+
+    inline const std::string& root() const { return m_root; }
+
+    /// Index of the named channel, or -1.
+    int find(const std::string& name) const;
+
+    inline size_t size() const { return m_channels.size(); }
+
+    inline const std::string& name(size_t index) const { return m_channels[index].name; }
+
+    /// False for a channel that disappeared in the last scan().
+    bool available(size_t index) const;
+
+    /// Read one channel in degrees Celsius.
+    bool read(size_t index, double& value) const;
+
+    /// Read up to count channels in one pass, returns the number read.
+    size_t read_all(double* values, size_t count) const;
+
+    virtual ~HwmonSensors();
+
+protected:
+
+    bool read_locked(size_t index, double& value) const;
+
+    struct Channel
+    {
+        std::string name;
+        int fd;
+    };
+
+    std::string m_root;
+    std::vector<Channel> m_channels;
+    mutable std::mutex m_mutex;
+};
+
+class SensorRegistry
+{
+public:
+
+    SensorRegistry();
+
+    inline HwmonSensors& hwmon() { return m_hwmon; }
 
-double get_temp_sensor(const std::string& name);
+    /**
+     * Simulated room instance, created on first use.
+     *
+     * The "fake" sensor reads room 0, "room:<n>" reads room n.
+     */
+    RoomModel& room(size_t index);
+
+    /// Replay speed for "trace:<path>" sensors, see TraceReplay.
+    inline void trace_speed(double speed) { m_trace_speed = speed; }
+
+    /// Resolve a sensor name, as returned by enumerate_temp_sensors().
+    SensorHandle resolve(const std::string& name);
+
+    /// Read the current value of a resolved sensor.
+    bool read(const SensorHandle& handle, double& value);
+
+    /// True if every read of the sensor is a new reading, so the reader
+    /// need not wait in between, like a trace replayed at speed 0.
+    inline bool unpaced(const SensorHandle& handle) const
+    {
+        return handle.type == SensorHandle::backend::trace && m_trace_speed <= 0.;
+    }
+
+    virtual ~SensorRegistry();
+
+protected:
+
+    std::deque<RoomModel> m_rooms;
+    std::mutex m_mutex;
+    std::deque<std::pair<std::string, TraceReplay>> m_traces;
+    std::atomic<double> m_trace_speed{1.};
+    HwmonSensors m_hwmon;
+};
+
+SensorRegistry& sensor_registry();
+
+/**
+ * Cached list of available temperature sensor names.
+ *
+ * The list is built on first use without reading any values.  Once watched,
+ * kernel uevents for hwmon and IIO devices rescan only the backend that
+ * changed; sysfs itself reports no device changes to inotify.  Without
+ * uevents, for example in a container, both are rescanned periodically.
+ */
+class SensorCatalog
+{
+public:
+
+    /// Invoked on the UI thread when the list of sensors changes.
+    egt::Signal<> on_change;
+
+    explicit SensorCatalog(SensorRegistry& registry);
+
+    SensorCatalog(const SensorCatalog&) = delete;
+    SensorCatalog& operator=(const SensorCatalog&) = delete;
+
+    const std::vector<std::string>& sensors();
+
+    /// Watch for devices coming and going from the EGT event loop.
+    void watch();
+
+    /// Stop watching, before the event loop goes away.
+    void unwatch();
+
+    /// Rescan the given backends, and report if the list changed.
+    void update(bool hwmon, bool iio);
+
+    virtual ~SensorCatalog();
+
+protected:
+
+    void build();
+    void arm();
+    void receive();
+
+    SensorRegistry& m_registry;
+    std::vector<std::string> m_names;
+    /// fake and libsensors names, fixed once built
+    size_t m_fixed{0};
+    std::vector<std::string> m_hwmon;
+    std::vector<std::string> m_iio;
+    bool m_built{false};
+    int m_uevent{-1};
+
+    struct watch_impl;
+    std::unique_ptr<watch_impl> m_watch;
+};
+
+SensorCatalog& sensor_catalog();
+
+std::vector<std::string> enumerate_temp_sensors();
 
 #endif
@@ -5,11 +5,20 @@
  */
 #include "config.h"
 #include "settings.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 #include <map>
+#include <mutex>
 #if ENABLE_DATABASE
 #include <sqlite3pp.h>
 #endif
 #include <string>
+#include <thread>
 
 #include <filesystem>
 namespace fs = std::filesystem;
@@ -22,26 +31,721 @@ static inline const char* db_path()
         return install_path;
     return "thermostat.db";
 }
+
+/// Quiet time after a set() before config is written, so a dragged slider
+/// is written once.
+static constexpr auto WRITE_DEBOUNCE = std::chrono::seconds(1);
+/// Longest a set() waits to be written while more keep coming.
+static constexpr auto WRITE_MAX_DELAY = std::chrono::seconds(5);
+/// Log rows are written in one transaction once this many are staged, or
+/// once the oldest has waited LOG_INTERVAL.
+static constexpr size_t LOG_BATCH = 64;
+static constexpr auto LOG_INTERVAL = std::chrono::seconds(30);
+/// Staged log rows beyond this are dropped, so a stuck database costs a
+/// bounded amount of memory and never blocks the UI thread.
+static constexpr size_t LOG_MAX_ROWS = 4096;
+
+/// PRAGMA user_version of a database whose log rows are stamped by
+/// log_time().  Before it they were nanoseconds since boot.
+static constexpr int LOG_TIME_VERSION = 1;
+
+/// log rows are stamped with milliseconds since the Unix epoch
+static inline long long int log_time()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+struct TempRow
+{
+    double temp;
+    long long int datetime;
+};
+
+struct StatusRow
+{
+    int zone;
+    int status;
+    int fan;
+    long long int datetime;
+};
+
+/// bound values of a row, without SQLite record and page overhead
+static constexpr size_t TEMP_ROW_BYTES = sizeof(double) + sizeof(long long int);
+static constexpr size_t STATUS_ROW_BYTES = 3 * sizeof(int) + sizeof(long long int);
+
+static constexpr long long int MINUTE_MS = 60 * 1000;
+static constexpr long long int HOUR_MS = 60 * MINUTE_MS;
+static constexpr long long int DAY_MS = 24 * HOUR_MS;
+
+/// Rollup tables, finest first, and the period of their rows.
+static const char* const ROLLUP_TABLES[] = {"log_minute", "log_hour", "log_day"};
+static constexpr long long int ROLLUP_PERIODS[] = {MINUTE_MS, HOUR_MS, DAY_MS};
+
+/// Staged rows reach the database within LOG_INTERVAL, so a minute is
+/// folded once it ended twice that long ago.
+static constexpr long long int ROLLUP_DELAY_MS =
+    2 * std::chrono::duration_cast<std::chrono::milliseconds>(LOG_INTERVAL).count();
+/// How often the writer looks for rollup and retention work once caught up.
+static constexpr auto ROLLUP_INTERVAL = std::chrono::minutes(1);
+/// Rows deleted per statement, so retention never holds the write lock long.
+static constexpr int EXPIRE_BATCH = 500;
+
+static inline long long int floor_to(long long int time, long long int period)
+{
+    return time - time % period;
+}
+
+/**
+ * Folds raw log rows into minute periods, and those into hour and day
+ * periods, then deletes rows past their retention.
+ *
+ * Runs on the writer thread and connection, in steps bounded to an hour of
+ * raw rows or a batch of deletes, so log and config writes never wait long
+ * behind it.  Raw rows are only deleted once folded.
+ */
+class LogRollup
+{
+public:
+
+    /// Days of raw, minute and hour rows kept.
+    using Retention = std::array<int, 3>;
+
+    explicit LogRollup(sqlite3pp::database& db);
+
+    /// Do one step of work at now, milliseconds since the Unix epoch.
+    /// False once there is nothing left to do.
+    bool step(long long int now, const Retention& days);
+
+    unsigned long long folded{0};
+    unsigned long long expired{0};
+
+protected:
+
+    struct Bucket
+    {
+        int samples{0};
+        double min{0};
+        double max{0};
+        double sum{0};
+        double heat{0};
+        double cool{0};
+    };
+
+    bool fold(long long int now);
+    bool expire(long long int now, const Retention& days);
+    /// Add the duty of the current status over [from, to) to the buckets.
+    void duty(long long int from, long long int to);
+
+    sqlite3pp::database& m_db;
+    sqlite3pp::query m_next_temp;
+    sqlite3pp::query m_next_status;
+    sqlite3pp::query m_temps;
+    sqlite3pp::query m_statuses;
+    sqlite3pp::command m_minute;
+    sqlite3pp::command m_hour;
+    sqlite3pp::command m_day;
+    sqlite3pp::command m_mark;
+    std::array<sqlite3pp::command, 4> m_expire;
+
+    /// raw rows before this are folded, and the zone 0 status there
+    long long int m_upto{0};
+    int m_status{0};
+    /// minutes of the hour being folded
+    long long int m_hour_start{0};
+    std::array<Bucket, 60> m_buckets{};
+};
+
+/// Recompute one period of a rollup from the finer one.
+static std::string rollup_sql(const char* table, const char* from)
+{
+    return std::string("REPLACE INTO ") + table +
+           " SELECT :start, SUM(samples), MIN(temp_min), MAX(temp_max), "
+           "SUM(temp_mean * samples) / NULLIF(SUM(samples), 0), SUM(heat), SUM(cool) "
+           "FROM " + from + " WHERE datetime >= :start AND datetime < :end HAVING COUNT(*)";
+}
+
+/// Delete a batch of rows older than :before.
+static std::string expire_sql(const char* table)
+{
+    return std::string("DELETE FROM ") + table + " WHERE rowid IN (SELECT rowid FROM " +
+           table + " WHERE datetime < :before ORDER BY datetime LIMIT " +
+           std::to_string(EXPIRE_BATCH) + ")";
+}
+
+LogRollup::LogRollup(sqlite3pp::database& db)
+    : m_db(db),
+      m_next_temp(db, "SELECT datetime FROM temp_log WHERE datetime >= :from "
+                  "ORDER BY datetime LIMIT 1"),
+      m_next_status(db, "SELECT datetime FROM status_log WHERE zone = 0 AND datetime >= :from "
+                    "ORDER BY datetime LIMIT 1"),
+      m_temps(db, "SELECT datetime, temp FROM temp_log "
+              "WHERE datetime >= :from AND datetime < :to"),
+      m_statuses(db, "SELECT datetime, status FROM status_log "
+                 "WHERE zone = 0 AND datetime >= :from AND datetime < :to ORDER BY datetime"),
+      m_minute(db, "REPLACE INTO log_minute (datetime, samples, temp_min, temp_max, temp_mean, heat, cool) "
+               "VALUES (:datetime, :samples, :min, :max, :mean, :heat, :cool)"),
+      m_hour(db, rollup_sql("log_hour", "log_minute").c_str()),
+      m_day(db, rollup_sql("log_day", "log_hour").c_str()),
+      m_mark(db, "REPLACE INTO log_rollup (id, upto, status) VALUES (0, :upto, :status)"),
+      m_expire{{sqlite3pp::command{db, expire_sql("temp_log").c_str()},
+                sqlite3pp::command{db, expire_sql("status_log").c_str()},
+                sqlite3pp::command{db, expire_sql("log_minute").c_str()},
+                sqlite3pp::command{db, expire_sql("log_hour").c_str()}}}
+{
+    sqlite3pp::query qry(m_db, "SELECT upto, status FROM log_rollup WHERE id = 0");
+    auto i = qry.begin();
+    if (i != qry.end())
+    {
+        m_upto = (*i).get<long long int>(0);
+        m_status = (*i).get<int>(1);
+    }
+}
+
+bool LogRollup::step(long long int now, const Retention& days)
+{
+    return fold(now) || expire(now, days);
+}
+
+void LogRollup::duty(long long int from, long long int to)
+{
+    const auto heating = static_cast<int>(Logic::status::heating);
+    const auto cooling = static_cast<int>(Logic::status::cooling);
+    if (m_status != heating && m_status != cooling)
+        return;
+
+    while (from < to)
+    {
+        const auto minute = (from - m_hour_start) / MINUTE_MS;
+        const auto end = std::min(to, m_hour_start + (minute + 1) * MINUTE_MS);
+        auto& bucket = m_buckets[minute];
+        (m_status == heating ? bucket.heat : bucket.cool) += (end - from) / 1000.;
+        from = end;
+    }
+}
+
+bool LogRollup::fold(long long int now)
+{
+    const auto cutoff = floor_to(now - ROLLUP_DELAY_MS, MINUTE_MS);
+    if (m_upto >= cutoff)
+        return false;
+
+    auto from = m_upto;
+    if (m_status == static_cast<int>(Logic::status::off))
+    {
+        // nothing to fold until the next row, however long ago the last was
+        auto next = cutoff;
+        for (auto qry : {&m_next_temp, &m_next_status})
+        {
+            qry->reset();
+            qry->bind(":from", from);
+            auto i = qry->begin();
+            if (i != qry->end())
+                next = std::min(next, floor_to((*i).get<long long int>(0), MINUTE_MS));
+        }
+        from = std::max(from, next);
+    }
+
+    // never past the end of the hour, so only one hour and day change
+    m_hour_start = floor_to(from, HOUR_MS);
+    const auto to = std::min(m_hour_start + HOUR_MS, cutoff);
+    const auto upto = m_upto;
+    const auto status = m_status;
+    m_buckets.fill(Bucket{});
+
+    auto ok = m_db.execute("BEGIN") == SQLITE_OK;
+    auto periods = 0;
+    if (ok && from < to)
+    {
+        m_temps.reset();
+        m_temps.bind(":from", from);
+        m_temps.bind(":to", to);
+        for (auto i = m_temps.begin(); i != m_temps.end(); ++i)
+        {
+            auto& bucket = m_buckets[((*i).get<long long int>(0) - m_hour_start) / MINUTE_MS];
+            const auto temp = (*i).get<double>(1);
+            bucket.min = bucket.samples ? std::min(bucket.min, temp) : temp;
+            bucket.max = bucket.samples ? std::max(bucket.max, temp) : temp;
+            bucket.sum += temp;
+            ++bucket.samples;
+        }
+
+        m_statuses.reset();
+        m_statuses.bind(":from", from);
+        m_statuses.bind(":to", to);
+        auto t = from;
+        for (auto i = m_statuses.begin(); i != m_statuses.end(); ++i)
+        {
+            const auto datetime = (*i).get<long long int>(0);
+            duty(t, datetime);
+            t = datetime;
+            m_status = (*i).get<int>(1);
+        }
+        duty(t, to);
+
+        for (size_t minute = 0; ok && minute < m_buckets.size(); ++minute)
+        {
+            const auto& bucket = m_buckets[minute];
+            if (!bucket.samples && bucket.heat <= 0 && bucket.cool <= 0)
+                continue;
+
+            m_minute.reset();
+            m_minute.bind(":datetime", m_hour_start + static_cast<long long int>(minute) * MINUTE_MS);
+            m_minute.bind(":samples", bucket.samples);
+            if (bucket.samples)
+            {
+                m_minute.bind(":min", bucket.min);
+                m_minute.bind(":max", bucket.max);
+                m_minute.bind(":mean", bucket.sum / bucket.samples);
+            }
+            else
+            {
+                m_minute.bind(":min", nullptr);
+                m_minute.bind(":max", nullptr);
+                m_minute.bind(":mean", nullptr);
+            }
+            m_minute.bind(":heat", bucket.heat);
+            m_minute.bind(":cool", bucket.cool);
+            ok = m_minute.execute() == SQLITE_OK;
+            ++periods;
+        }
+
+        if (periods)
+        {
+            const auto day = floor_to(m_hour_start, DAY_MS);
+            m_hour.reset();
+            m_hour.bind(":start", m_hour_start);
+            m_hour.bind(":end", m_hour_start + HOUR_MS);
+            m_day.reset();
+            m_day.bind(":start", day);
+            m_day.bind(":end", day + DAY_MS);
+            ok = ok && m_hour.execute() == SQLITE_OK && m_day.execute() == SQLITE_OK;
+        }
+    }
+
+    m_upto = std::max(from, to);
+    m_mark.reset();
+    m_mark.bind(":upto", m_upto);
+    m_mark.bind(":status", m_status);
+    ok = ok && m_mark.execute() == SQLITE_OK;
+    ok = ok && m_db.execute("COMMIT") == SQLITE_OK;
+    if (!ok)
+    {
+        std::cerr << "failed to roll up logs: " << m_db.error_msg() << std::endl;
+        m_db.execute("ROLLBACK");
+        m_upto = upto;
+        m_status = status;
+        return false;
+    }
+
+    folded += periods;
+    return true;
+}
+
+bool LogRollup::expire(long long int now, const Retention& days)
+{
+    // raw rows are kept until folded, however old
+    const long long int before[] =
+    {
+        std::min(m_upto, now - days[0] * DAY_MS),
+        std::min(m_upto, now - days[0] * DAY_MS),
+        now - days[1] * DAY_MS,
+        now - days[2] * DAY_MS,
+    };
+
+    auto more = false;
+    for (size_t i = 0; i < m_expire.size(); ++i)
+    {
+        m_expire[i].reset();
+        m_expire[i].bind(":before", before[i]);
+        if (m_expire[i].execute() != SQLITE_OK)
+        {
+            std::cerr << "failed to expire logs: " << m_db.error_msg() << std::endl;
+            return false;
+        }
+        const auto changes = m_db.changes();
+        expired += changes;
+        more = more || changes >= EXPIRE_BATCH;
+    }
+    return more;
+}
 #endif
 
 struct Settings::settings_impl
 {
     std::map<std::string, std::string> cache;
+    /// schedule as last saved, read back before it is written
+    std::vector<Schedule::Transition> schedule;
+    bool schedule_saved{false};
 #if ENABLE_DATABASE
     sqlite3pp::database db{db_path()};
     sqlite3pp::query config_qry{db,
                   "SELECT value FROM config WHERE key=:key LIMIT 1"};
-    sqlite3pp::command config_cmd{db,
-                  "REPLACE INTO config (key,value) VALUES (:key,:value)"};
+
+    void write_behind();
+
+    /// Hand staged config to the writer.
+    void queue();
+
+    /// config set in the open transaction, UI thread only
+    std::map<std::string, std::string> staged;
+    /// schedule saved in the open transaction, UI thread only
+    bool schedule_staged{false};
+
+    /// Stage a log row, false if dropped.
+    template<class T>
+    bool log(std::vector<T>& rows, const T& row);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    /// config not written yet, latest value of each key
+    std::map<std::string, std::string> dirty;
+    std::chrono::steady_clock::time_point first;
+    std::chrono::steady_clock::time_point due;
+    /// schedule not written yet, replaces the table
+    std::vector<Schedule::Transition> schedule_rows;
+    bool schedule_dirty{false};
+    /// set() and save_schedule() calls queued, tried and written, for flush()
+    unsigned long queued{0};
+    unsigned long tried{0};
+    unsigned long written{0};
+
+    /// log rows not written yet
+    std::vector<TempRow> temp_rows;
+    std::vector<StatusRow> status_rows;
+    std::chrono::steady_clock::time_point log_due;
+    /// log rows staged and tried, for flush()
+    unsigned long long logged{0};
+    unsigned long long log_tried{0};
+    LogStats log_stats;
+    LogRollup::Retention retention{};
+
+    bool stop{false};
+    std::thread writer;
 #endif
 };
 
+#if ENABLE_DATABASE
+void Settings::settings_impl::queue()
+{
+    bool idle;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto now = std::chrono::steady_clock::now();
+        idle = dirty.empty() && !schedule_dirty;
+        if (idle)
+            first = now;
+        for (auto& i : staged)
+            dirty[i.first] = std::move(i.second);
+        queued += staged.size();
+        if (schedule_staged)
+        {
+            schedule_rows = schedule;
+            schedule_dirty = true;
+            ++queued;
+        }
+        due = std::min(now + WRITE_DEBOUNCE, first + WRITE_MAX_DELAY);
+    }
+    staged.clear();
+    schedule_staged = false;
+    // otherwise the writer is already waiting, and finds the later due time
+    if (idle)
+        cv.notify_all();
+}
+
+template<class T>
+bool Settings::settings_impl::log(std::vector<T>& rows, const T& row)
+{
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto staged = temp_rows.size() + status_rows.size();
+        if (staged >= LOG_MAX_ROWS)
+        {
+            ++log_stats.dropped;
+            return false;
+        }
+
+        if (!staged)
+            log_due = std::chrono::steady_clock::now() + LOG_INTERVAL;
+        rows.push_back(row);
+        ++logged;
+        // the writer already waits for the first row, and a full batch
+        wake = !staged || staged + 1 == LOG_BATCH;
+    }
+    if (wake)
+        cv.notify_all();
+    return true;
+}
+
+void Settings::settings_impl::write_behind()
+{
+    // a connection of its own, so nothing here joins a UI transaction
+    sqlite3pp::database wdb(db_path());
+    wdb.execute("PRAGMA busy_timeout = 5000");
+    // prepared once, and run for every row of a batch
+    sqlite3pp::command config_cmd(wdb, "REPLACE INTO config (key,value) VALUES (:key,:value)");
+    sqlite3pp::command temp_cmd(wdb,
+                                "INSERT INTO temp_log (temp, datetime) VALUES (:temp, :datetime)");
+    sqlite3pp::command status_cmd(wdb,
+                                  "INSERT INTO status_log (zone, status, fan, datetime) "
+                                  "VALUES (:zone, :status, :fan, :datetime)");
+    sqlite3pp::command schedule_clear(wdb, "DELETE FROM schedule");
+    sqlite3pp::command schedule_cmd(wdb,
+                                    "INSERT INTO schedule (dow, temp, time) VALUES (:dow, :temp, :time)");
+    // ranges of raw rows are read and deleted by datetime
+    wdb.execute("CREATE INDEX IF NOT EXISTS temp_log_datetime ON temp_log (datetime)");
+    wdb.execute("CREATE INDEX IF NOT EXISTS status_log_datetime ON status_log (datetime)");
+    LogRollup rollup(wdb);
+    auto rollup_due = std::chrono::steady_clock::now() + ROLLUP_INTERVAL;
+
+    std::map<std::string, std::string> config;
+    std::vector<Schedule::Transition> schedule;
+    bool replace = false;
+    std::vector<TempRow> temps;
+    std::vector<StatusRow> statuses;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        const auto rows = temp_rows.size() + status_rows.size();
+        const auto now = std::chrono::steady_clock::now();
+        const auto config_due = (!dirty.empty() || schedule_dirty) && (stop || now >= due);
+        const auto logs_due = rows && (stop || rows >= LOG_BATCH || now >= log_due);
+        if (!config_due && !logs_due)
+        {
+            // on stop, nothing is left
+            if (stop)
+                break;
+
+            if (now >= rollup_due)
+            {
+                const auto days = retention;
+                lock.unlock();
+                const auto more = rollup.step(log_time(), days);
+                lock.lock();
+                log_stats.folded = rollup.folded;
+                log_stats.expired = rollup.expired;
+                // one step at a time, with writes let in between
+                rollup_due = more ? now : std::chrono::steady_clock::now() + ROLLUP_INTERVAL;
+                continue;
+            }
+
+            auto wake = rollup_due;
+            if (!dirty.empty() || schedule_dirty)
+                wake = std::min(wake, due);
+            if (rows)
+                wake = std::min(wake, log_due);
+            cv.wait_until(lock, wake);
+            continue;
+        }
+
+        // take whatever is waiting, due or not, into the one transaction
+        config.swap(dirty);
+        replace = schedule_dirty;
+        if (replace)
+            schedule.swap(schedule_rows);
+        schedule_dirty = false;
+        temps.swap(temp_rows);
+        statuses.swap(status_rows);
+        const auto upto = queued;
+        const auto log_upto = logged;
+        lock.unlock();
+
+        auto ok = wdb.execute("BEGIN") == SQLITE_OK;
+        for (auto i = config.begin(); ok && i != config.end(); ++i)
+        {
+            config_cmd.reset();
+            config_cmd.bind(":key", i->first, sqlite3pp::nocopy);
+            config_cmd.bind(":value", i->second, sqlite3pp::nocopy);
+            ok = config_cmd.execute() == SQLITE_OK;
+        }
+        if (ok && replace)
+        {
+            schedule_clear.reset();
+            ok = schedule_clear.execute() == SQLITE_OK;
+        }
+        for (auto i = schedule.begin(); ok && replace && i != schedule.end(); ++i)
+        {
+            schedule_cmd.reset();
+            schedule_cmd.bind(":dow", i->dow);
+            schedule_cmd.bind(":temp", i->target.celsius());
+            schedule_cmd.bind(":time", i->minute);
+            ok = schedule_cmd.execute() == SQLITE_OK;
+        }
+        for (auto i = temps.begin(); ok && i != temps.end(); ++i)
+        {
+            temp_cmd.reset();
+            temp_cmd.bind(":temp", i->temp);
+            temp_cmd.bind(":datetime", i->datetime);
+            ok = temp_cmd.execute() == SQLITE_OK;
+        }
+        for (auto i = statuses.begin(); ok && i != statuses.end(); ++i)
+        {
+            status_cmd.reset();
+            status_cmd.bind(":zone", i->zone);
+            status_cmd.bind(":status", i->status);
+            status_cmd.bind(":fan", i->fan);
+            status_cmd.bind(":datetime", i->datetime);
+            ok = status_cmd.execute() == SQLITE_OK;
+        }
+        ok = ok && wdb.execute("COMMIT") == SQLITE_OK;
+        if (!ok)
+        {
+            std::cerr << (replace ? "failed to save settings and schedule: " : "failed to save settings: ")
+                      << wdb.error_msg() << std::endl;
+            wdb.execute("ROLLBACK");
+        }
+
+        lock.lock();
+        tried = upto;
+        log_tried = log_upto;
+        if (ok)
+        {
+            written = upto;
+            ++log_stats.commits;
+            log_stats.rows += temps.size() + statuses.size();
+            log_stats.bytes += temps.size() * TEMP_ROW_BYTES + statuses.size() * STATUS_ROW_BYTES;
+        }
+        else
+        {
+            // config and the schedule are retried, unless a newer value came
+            // in meanwhile, while log rows are dropped to keep memory bounded
+            log_stats.dropped += temps.size() + statuses.size();
+            if (!stop)
+            {
+                for (auto& i : config)
+                    dirty.emplace(i.first, std::move(i.second));
+                if (replace && !schedule_dirty)
+                {
+                    schedule_rows.swap(schedule);
+                    schedule_dirty = true;
+                }
+                first = due = std::chrono::steady_clock::now() + WRITE_DEBOUNCE;
+            }
+        }
+        config.clear();
+        schedule.clear();
+        temps.clear();
+        statuses.clear();
+        cv.notify_all();
+    }
+}
+#endif
+
 Settings::Settings()
     : m_impl(new settings_impl)
 {
 #if ENABLE_DATABASE
     // store temp tables in memory
     m_impl->db.execute("PRAGMA temp_store = MEMORY");
+    // readers never wait on the config writer, and writers wait their turn
+    m_impl->db.execute("PRAGMA journal_mode = WAL");
+    m_impl->db.execute("PRAGMA busy_timeout = 5000");
+
+    // databases created before zones were added have no zone column
+    sqlite3pp::query qry(m_impl->db,
+                         "SELECT COUNT(*) FROM pragma_table_info('status_log') WHERE name='zone'");
+    auto i = qry.begin();
+    if (i != qry.end() && (*i).get<int>(0) == 0)
+        m_impl->db.execute("ALTER TABLE status_log ADD COLUMN `zone` INTEGER NOT NULL DEFAULT 0");
+
+    // databases created before rollups have none of their tables
+    m_impl->db.execute("CREATE TABLE IF NOT EXISTS `log_rollup` ("
+                       "`id` INTEGER NOT NULL PRIMARY KEY, "
+                       "`upto` INTEGER NOT NULL, "
+                       "`status` INTEGER NOT NULL)");
+    for (const auto table : ROLLUP_TABLES)
+        m_impl->db.executef("CREATE TABLE IF NOT EXISTS `%s` ("
+                            "`datetime` INTEGER NOT NULL PRIMARY KEY, "
+                            "`samples` INTEGER NOT NULL, "
+                            "`temp_min` REAL, `temp_max` REAL, `temp_mean` REAL, "
+                            "`heat` REAL NOT NULL, `cool` REAL NOT NULL)", table);
+
+    // log rows stamped with the time since some earlier boot cannot be put
+    // on the calendar, so they and whatever was rolled up from them go
+    sqlite3pp::query version(m_impl->db, "PRAGMA user_version");
+    auto v = version.begin();
+    if (v != version.end() && (*v).get<int>(0) < LOG_TIME_VERSION)
+    {
+        auto ok = m_impl->db.execute("BEGIN") == SQLITE_OK;
+        for (const auto table : {"temp_log", "status_log", "log_rollup"})
+            ok = ok && m_impl->db.executef("DELETE FROM `%s`", table) == SQLITE_OK;
+        for (const auto table : ROLLUP_TABLES)
+            ok = ok && m_impl->db.executef("DELETE FROM `%s`", table) == SQLITE_OK;
+        ok = ok && m_impl->db.executef("PRAGMA user_version = %d", LOG_TIME_VERSION) == SQLITE_OK;
+        ok = ok && m_impl->db.execute("COMMIT") == SQLITE_OK;
+        if (!ok)
+        {
+            std::cerr << "failed to drop old log rows: " << m_impl->db.error_msg() << std::endl;
+            m_impl->db.execute("ROLLBACK");
+        }
+    }
+
+    // retention is read here, and handed to the writer
+    const auto retain = [this]()
+    {
+        const LogRollup::Retention days =
+        {
+            integer<setting::log_raw_days>(),
+            integer<setting::log_minute_days>(),
+            integer<setting::log_hour_days>(),
+        };
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        m_impl->retention = days;
+    };
+    for (const auto key : {"log_raw_days", "log_minute_days", "log_hour_days"})
+    {
+        on_change(key).on_event([retain](const std::string&, const std::string&)
+        {
+            retain();
+        });
+    }
+    retain();
+
+    m_impl->writer = std::thread(&settings_impl::write_behind, m_impl.get());
+#endif
+}
+
+Settings::~Settings()
+{
+#if ENABLE_DATABASE
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        m_impl->stop = true;
+    }
+    m_impl->cv.notify_all();
+    if (m_impl->writer.joinable())
+        m_impl->writer.join();
+#endif
+}
+
+bool Settings::flush()
+{
+#if ENABLE_DATABASE
+    std::unique_lock<std::mutex> lock(m_impl->mutex);
+    const auto target = m_impl->queued;
+    const auto log_target = m_impl->logged;
+    const auto dropped = m_impl->log_stats.dropped;
+    m_impl->due = m_impl->log_due = std::chrono::steady_clock::time_point();
+    m_impl->cv.notify_all();
+    m_impl->cv.wait(lock, [this, target, log_target]()
+    {
+        return m_impl->tried >= target && m_impl->log_tried >= log_target;
+    });
+    return m_impl->written >= target && m_impl->log_stats.dropped == dropped;
+#else
+    return true;
+#endif
+}
+
+Settings::LogStats Settings::log_stats()
+{
+#if ENABLE_DATABASE
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    return m_impl->log_stats;
+#else
+    return {};
 #endif
 }
 
@@ -50,19 +754,129 @@ void Settings::set_default_callback(default_value_callback_t callback)
     m_default_callback = callback;
 }
 
+/// Typed setting with name, nullptr if none.
+static const setting::Key* find_key(const std::string& name)
+{
+    for (const auto& key : setting::keys)
+        if (name == key.name)
+            return &key;
+    return nullptr;
+}
+
+static bool parse(const setting::Key& key, const char* text, Settings::Value& value)
+{
+    char* end = nullptr;
+    switch (key.kind)
+    {
+    case setting::type::flag:
+        if (std::strcmp(text, "on") == 0)
+            value.integer = 1;
+        else if (std::strcmp(text, "off") == 0)
+            value.integer = 0;
+        else
+            return false;
+        return true;
+    case setting::type::integer:
+    {
+        const auto v = std::strtol(text, &end, 10);
+        if (end == text || *end)
+            return false;
+        value.integer = static_cast<int>(std::min<double>(std::max<double>(v, key.min), key.max));
+        return true;
+    }
+    case setting::type::real:
+    {
+        const auto v = std::strtod(text, &end);
+        if (end == text || *end || !std::isfinite(v))
+            return false;
+        value.real = std::min(std::max(v, key.min), key.max);
+        return true;
+    }
+    case setting::type::choice:
+    {
+        const auto len = std::strlen(text);
+        auto index = 0;
+        for (auto c = key.choices; ; ++index)
+        {
+            const auto next = std::strchr(c, '|');
+            const auto size = next ? static_cast<size_t>(next - c) : std::strlen(c);
+            if (size == len && std::strncmp(c, text, len) == 0)
+            {
+                value.integer = index;
+                return true;
+            }
+            if (!next)
+                return false;
+            c = next + 1;
+        }
+    }
+    case setting::type::text:
+        return true;
+    }
+    return false;
+}
+
+void Settings::decode(setting::key k)
+{
+    const auto& key = setting::keys[k];
+    auto& value = m_values[k];
+    value = Value{};
+    value.decoded = true;
+
+    if (parse(key, get(key.name).c_str(), value))
+        return;
+    if (key.fallback && parse(key, key.fallback, value))
+        return;
+    if (!key.fallback && m_default_callback)
+        parse(key, m_default_callback(key.name).c_str(), value);
+}
+
 void Settings::set(const std::string& key, const std::string& value)
 {
+    // remember only the first old value of a transaction
+    if (m_signals.count(key) && !m_changed.count(key))
+        m_changed.emplace(key, get(key));
+
     m_impl->cache[key] = value;
 
+    const auto typed = find_key(key);
+    if (typed)
+        decode(static_cast<setting::key>(typed - setting::keys));
+
+    if (m_tx)
+        m_tx_changed = true;
+
 #if ENABLE_DATABASE
-    m_impl->config_cmd.reset();
-    m_impl->config_cmd.bind(":key", key, sqlite3pp::nocopy);
-    m_impl->config_cmd.bind(":value", value, sqlite3pp::nocopy);
-    m_impl->config_cmd.execute();
+    // a transaction reaches the writer in one piece, when it ends
+    m_impl->staged[key] = value;
+    if (!m_tx)
+        m_impl->queue();
 #endif
+
+    if (!m_tx)
+        notify();
 }
 
-std::string Settings::get(const std::string& key)
+Settings::ChangeSignal& Settings::on_change(const std::string& key)
+{
+    return m_signals[key];
+}
+
+void Settings::notify()
+{
+    // observers may set() again
+    auto changed = std::move(m_changed);
+    m_changed.clear();
+
+    for (const auto& c : changed)
+    {
+        const auto value = get(c.first);
+        if (value != c.second)
+            m_signals[c.first].invoke(c.second, value);
+    }
+}
+
+const std::string& Settings::get(const std::string& key)
 {
     const auto c = m_impl->cache.find(key);
     if (c != m_impl->cache.end())
@@ -78,59 +892,162 @@ std::string Settings::get(const std::string& key)
         // careful for NULL values
         auto v = (*i).get<char const*>(0);
         if (v)
-        {
-            m_impl->cache[key] = v;
-            return v;
-        }
+            return m_impl->cache[key] = v;
     }
 #endif
 
+    const auto typed = find_key(key);
+    if (typed && typed->fallback)
+        return m_impl->cache[key] = typed->fallback;
+
     if (m_default_callback)
+        return m_impl->cache[key] = m_default_callback(key);
+
+    static const std::string empty;
+    return empty;
+}
+
+void Settings::temp_log(Temperature temp)
+{
+#if ENABLE_DATABASE
+    m_impl->log(m_impl->temp_rows, TempRow{temp.celsius(), log_time()});
+#endif
+}
+
+void Settings::status_log(Logic::status status, bool fan, size_t zone)
+{
+#if ENABLE_DATABASE
+    m_impl->log(m_impl->status_rows, StatusRow{static_cast<int>(zone), static_cast<int>(status),
+                                               static_cast<int>(fan), log_time()});
+#endif
+}
+
+std::vector<LogRecord> Settings::log_history()
+{
+    std::vector<LogRecord> records;
+#if ENABLE_DATABASE
+    // including rows still staged
+    flush();
+
+    sqlite3pp::query qry(m_impl->db,
+                         "SELECT datetime, temp, -1 FROM temp_log "
+                         "UNION ALL SELECT datetime, 0, status FROM status_log WHERE zone = 0 "
+                         "ORDER BY 1");
+    for (auto i = qry.begin(); i != qry.end(); ++i)
     {
-        m_impl->cache[key] = m_default_callback(key);
-        return m_impl->cache[key];
+        LogRecord r;
+        r.datetime = (*i).get<long long int>(0);
+        r.temp = (*i).get<double>(1);
+        r.status = (*i).get<int>(2);
+        records.push_back(r);
     }
-
-    return {};
+#endif
+    return records;
 }
 
-void Settings::temp_log(float temp)
+Settings::History Settings::history(long long from, long long to, size_t points)
 {
+    History history;
 #if ENABLE_DATABASE
-    sqlite3pp::command cmd(m_impl->db,
-                           "INSERT INTO temp_log (temp, datetime) VALUES (:temp, :datetime)");
-    cmd.bind(":temp", temp);
-    long long int since_epoch = std::chrono::steady_clock::now().time_since_epoch().count();
-    cmd.bind(":datetime", since_epoch);
-    cmd.execute();
+    const auto now = log_time();
+    // oldest minute and hour periods still kept, day periods are kept for good
+    const long long int kept[] =
+    {
+        now - integer<setting::log_minute_days>() * DAY_MS,
+        now - integer<setting::log_hour_days>() * DAY_MS,
+    };
+
+    size_t r = 0;
+    while (r < 2 && (from < kept[r] ||
+                     (to - from) / ROLLUP_PERIODS[r] > static_cast<long long int>(points)))
+        ++r;
+    history.period = ROLLUP_PERIODS[r];
+
+    sqlite3pp::query qry(m_impl->db,
+                         (std::string("SELECT datetime, samples, temp_min, temp_max, temp_mean, heat, cool "
+                                      "FROM ") + ROLLUP_TABLES[r] +
+                          " WHERE datetime >= :from AND datetime < :to ORDER BY datetime").c_str());
+    qry.bind(":from", floor_to(from, history.period));
+    qry.bind(":to", to);
+    for (auto i = qry.begin(); i != qry.end(); ++i)
+    {
+        Period p;
+        p.datetime = (*i).get<long long int>(0);
+        p.samples = (*i).get<int>(1);
+        p.temp_min = (*i).get<double>(2);
+        p.temp_max = (*i).get<double>(3);
+        p.temp_mean = (*i).get<double>(4);
+        p.heat = (*i).get<double>(5);
+        p.cool = (*i).get<double>(6);
+        history.periods.push_back(p);
+    }
 #endif
+    return history;
 }
 
-void Settings::status_log(Logic::status status, bool fan)
+std::vector<Schedule::Transition> Settings::load_schedule()
 {
+    // possibly not written yet
+    if (m_impl->schedule_saved)
+        return m_impl->schedule;
+
 #if ENABLE_DATABASE
-    sqlite3pp::command cmd(m_impl->db,
-                           "INSERT INTO status_log (status, fan, datetime) VALUES (:status, :fan, :datetime)");
-    cmd.bind(":status", static_cast<int>(status));
-    cmd.bind(":fan", static_cast<int>(fan));
-    long long int since_epoch = std::chrono::steady_clock::now().time_since_epoch().count();
-    cmd.bind(":datetime", since_epoch);
-    cmd.execute();
+    std::vector<Schedule::Transition> transitions;
+    sqlite3pp::query qry(m_impl->db,
+                         "SELECT dow, time, temp FROM schedule "
+                         "WHERE dow IS NOT NULL AND time IS NOT NULL AND temp IS NOT NULL");
+    for (auto i = qry.begin(); i != qry.end(); ++i)
+    {
+        Schedule::Transition t;
+        t.dow = (*i).get<int>(0);
+        t.minute = (*i).get<int>(1);
+        t.target = Temperature::from_celsius((*i).get<double>(2));
+        transitions.push_back(t);
+    }
+    return transitions;
+#else
+    return {};
 #endif
 }
 
-void Settings::begin_tx()
+void Settings::save_schedule(const std::vector<Schedule::Transition>& transitions)
 {
+    m_impl->schedule = transitions;
+    m_impl->schedule_saved = true;
+    if (m_tx)
+        m_tx_changed = true;
+
 #if ENABLE_DATABASE
-    m_impl->db.execute("BEGIN");
+    // written behind with the config of the same transaction
+    m_impl->schedule_staged = true;
+    if (!m_tx)
+        m_impl->queue();
 #endif
 }
 
+void Settings::begin_tx()
+{
+    ++m_tx;
+    ++m_tx_stats.scopes;
+}
+
 void Settings::end_tx()
 {
+    if (--m_tx)
+        return;
+
+    if (!m_tx_changed)
+    {
+        ++m_tx_stats.elided;
+        return;
+    }
+
+    m_tx_changed = false;
+    ++m_tx_stats.batches;
 #if ENABLE_DATABASE
-    m_impl->db.execute("COMMIT");
+    m_impl->queue();
 #endif
+    notify();
 }
 
 Settings& settings()
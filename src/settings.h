@@ -6,15 +6,144 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
+#include <egt/signal.h>
 #include <egt/utils.h>
+#include <array>
+#include <map>
 #include <string>
 #include <memory>
 #include "logic.h"
+#include "schedule.h"
+#include "thermal.h"
 #include <vector>
 
+namespace setting
+{
+
+/// How the stored text of a typed setting is decoded.
+enum class type : uint8_t
+{
+    /// "on" or "off"
+    flag,
+    integer,
+    real,
+    /// index of the value in a "first|second|..." list
+    choice,
+    /// any text, such as a path, read with get()
+    text,
+};
+
+/**
+ * Declaration of a typed setting.
+ *
+ * Numbers outside min and max are clamped.  A value that does not decode
+ * falls back to the default, and with no default the Settings default
+ * callback is asked, for values probed from hardware.
+ */
+struct Key
+{
+    const char* name;
+    type kind;
+    const char* fallback;
+    double min;
+    double max;
+    const char* choices;
+};
+
+/// Typed settings, in the order of keys.
+enum key : uint8_t
+{
+    degrees,
+    time_format,
+    outside,
+    background,
+    sql_logs,
+    schedule_enabled,
+    mode,
+    fan,
+    sleep_timeout,
+    sleep_brightness,
+    normal_brightness,
+    target_temp,
+    deadband,
+    heat_min_on,
+    heat_min_off,
+    cool_min_on,
+    cool_min_off,
+    fan_overrun,
+    outside_temp,
+    recovery_max,
+    sim_speed,
+    trace_speed,
+    filter_median,
+    filter_alpha,
+    filter_deadband,
+    filter_stuck,
+    sensor_max_period,
+    hvac_dead_time,
+    log_raw_days,
+    log_minute_days,
+    log_hour_days,
+    checkpoint,
+    count
+};
+
+inline constexpr Key keys[] =
+{
+    // same order as Temperature::unit
+    {"degrees", type::choice, "f", 0, 0, "c|f"},
+    {"time_format", type::integer, "12", 12, 24, nullptr},
+    {"outside", type::flag, "on", 0, 0, nullptr},
+    {"background", type::flag, "on", 0, 0, nullptr},
+    {"sql_logs", type::flag, "off", 0, 0, nullptr},
+    {"schedule_enabled", type::flag, "off", 0, 0, nullptr},
+    // same order as Logic::mode and Logic::fanmode
+    {"mode", type::choice, "auto", 0, 0, "off|auto|cool|heat"},
+    {"fan", type::choice, "auto", 0, 0, "on|auto"},
+    {"sleep_timeout", type::integer, "20", 1, 3600, nullptr},
+    {"sleep_brightness", type::integer, nullptr, 0, 1e6, nullptr},
+    {"normal_brightness", type::integer, nullptr, 0, 1e6, nullptr},
+    {"target_temp", type::real, "20", -40, 85, nullptr},
+    {"deadband", type::real, "1", 0, 10, nullptr},
+    {"heat_min_on", type::integer, "120", 0, 3600, nullptr},
+    {"heat_min_off", type::integer, "180", 0, 3600, nullptr},
+    {"cool_min_on", type::integer, "180", 0, 3600, nullptr},
+    {"cool_min_off", type::integer, "300", 0, 3600, nullptr},
+    {"fan_overrun", type::integer, "60", 0, 3600, nullptr},
+    {"outside_temp", type::real, "30", -60, 70, nullptr},
+    {"recovery_max", type::integer, "120", 0, 1440, nullptr},
+    {"sim_speed", type::real, "1", 0.001, 1e6, nullptr},
+    // 0 replays a trace as fast as possible
+    {"trace_speed", type::real, "1", 0, 1e6, nullptr},
+    {"filter_median", type::integer, "5", 1, 99, nullptr},
+    {"filter_alpha", type::real, "0.3", 0, 1, nullptr},
+    {"filter_deadband", type::real, "0.25", 0, 10, nullptr},
+    // minutes, 0 disables stuck sensor detection
+    {"filter_stuck", type::integer, "0", 0, 1440, nullptr},
+    {"sensor_max_period", type::integer, "32", 1, 3600, nullptr},
+    {"hvac_dead_time", type::integer, "1000", 0, 60000, nullptr},
+    // log retention, day rollups are kept for good
+    {"log_raw_days", type::integer, "7", 1, 3650, nullptr},
+    {"log_minute_days", type::integer, "31", 1, 3650, nullptr},
+    {"log_hour_days", type::integer, "366", 1, 36500, nullptr},
+    {"checkpoint", type::text, "/tmp/egt-thermostat.checkpoint", 0, 0, nullptr},
+};
+
+static_assert(sizeof(keys) / sizeof(keys[0]) == count, "a Key for every key");
+
+}
+
 struct Settings
 {
-    /// this does not currently support nesting of transactions
+    /**
+     * A transaction for the scope, nested in any already open.
+     *
+     * Settings set and a schedule saved inside are handed to the background
+     * writer together when the outermost scope ends, and it writes them in
+     * one SQLite transaction, batched with whatever else is waiting.  A
+     * nested scope joins the outermost, and a scope that changes nothing
+     * costs nothing.
+     */
     struct AutoTransaction
     {
         explicit AutoTransaction(Settings& settings)
@@ -33,19 +162,184 @@ struct Settings
 
     using default_value_callback_t = std::function<std::string(const std::string&)>;
 
+    /// Invoked with the old and the new value.
+    using ChangeSignal = egt::Signal<const std::string&, const std::string&>;
+
     Settings();
 
+    /// Write everything set so far to the database.
+    ~Settings();
+
     void set_default_callback(default_value_callback_t callback);
 
+    /**
+     * Store a value, and decode it again if it is a typed setting.
+     *
+     * The value is read back straight away, but written to the database
+     * later from a thread of its own, once no set() came in for a while.
+     * Only the last value of each key is written.
+     */
     void set(const std::string& key, const std::string& value);
-    std::string get(const std::string& key);
 
-    void temp_log(float temp);
-    void status_log(Logic::status status, bool fan);
+    /**
+     * Block until every value set and every log row staged so far is
+     * written to the database.  False if writing failed.
+     */
+    bool flush();
+
+    /**
+     * Invoked when the value of key changes.
+     *
+     * Inside a transaction this is once, after it ends, with the value
+     * from before the transaction.  Setting the same value again is not a
+     * change.
+     */
+    ChangeSignal& on_change(const std::string& key);
+    /// Valid until the next set() of the same key.
+    const std::string& get(const std::string& key);
+
+    /**
+     * Typed reads, an array index into values decoded once, on the first
+     * read and on every set().
+     */
+    template<setting::key K>
+    inline bool flag()
+    {
+        static_assert(setting::keys[K].kind == setting::type::flag, "not a flag");
+        return value(K).integer != 0;
+    }
+
+    template<setting::key K>
+    inline int integer()
+    {
+        static_assert(setting::keys[K].kind == setting::type::integer, "not an integer");
+        return value(K).integer;
+    }
+
+    template<setting::key K>
+    inline double real()
+    {
+        static_assert(setting::keys[K].kind == setting::type::real, "not a real");
+        return value(K).real;
+    }
+
+    /// Index of the value in the choices of the key, as an enum in the same order.
+    template<setting::key K, class T = unsigned>
+    inline T choice()
+    {
+        static_assert(setting::keys[K].kind == setting::type::choice, "not a choice");
+        return static_cast<T>(value(K).integer);
+    }
+
+    /// Telemetry written by the background writer.
+    struct LogStats
+    {
+        unsigned long long rows{0};
+        /// rows lost to a full staging buffer or a failed write
+        unsigned long long dropped{0};
+        unsigned long long commits{0};
+        /// values written, without SQLite record and page overhead
+        unsigned long long bytes{0};
+        /// minute periods folded into rollups
+        unsigned long long folded{0};
+        /// raw and rollup rows deleted past retention
+        unsigned long long expired{0};
+    };
+
+    /**
+     * Stage a log row.  Rows are written from the background writer, many
+     * to a transaction, and dropped if too many are waiting.
+     */
+    void temp_log(Temperature temp);
+    void status_log(Logic::status status, bool fan, size_t zone = 0);
+
+    LogStats log_stats();
+
+    /// All temp_log and zone 0 status_log rows still kept, in datetime order.
+    std::vector<LogRecord> log_history();
+
+    /// Temperature and duty of zone 0 over one period.
+    struct Period
+    {
+        /// start, milliseconds since the Unix epoch
+        long long datetime{0};
+        /// temperatures logged, none for a period with duty only
+        unsigned samples{0};
+        /// Celsius
+        double temp_min{0};
+        double temp_max{0};
+        double temp_mean{0};
+        /// seconds heating and cooling
+        double heat{0};
+        double cool{0};
+    };
+
+    struct History
+    {
+        /// length of every period, milliseconds
+        long long period{0};
+        std::vector<Period> periods;
+    };
+
+    /**
+     * Logged history from the minute, hour or day rollups, whichever is the
+     * finest still kept for the whole span that gives at most points
+     * periods.  Times are milliseconds since the Unix epoch.  Raw rows are
+     * folded a couple of minutes behind, so the latest periods lag.
+     */
+    History history(long long from, long long to, size_t points = 500);
+
+    /// The schedule last saved, written or not.
+    std::vector<Schedule::Transition> load_schedule();
+    /**
+     * Replace the whole schedule.  Like set(), the table is replaced from
+     * the background writer, together with the config of the same
+     * transaction, and a failed write is retried.
+     */
+    void save_schedule(const std::vector<Schedule::Transition>& transitions);
+
+    struct TxStats
+    {
+        /// AutoTransaction scopes, nested ones included
+        unsigned long scopes{0};
+        /// outermost scopes that changed something, handed to the writer
+        unsigned long batches{0};
+        /// outermost scopes that changed nothing
+        unsigned long elided{0};
+    };
+
+    inline const TxStats& tx_stats() const { return m_tx_stats; }
 
     void begin_tx();
     void end_tx();
 
+    struct Value
+    {
+        int integer{0};
+        double real{0};
+        bool decoded{false};
+    };
+
+    inline const Value& value(setting::key key)
+    {
+        if (!m_values[key].decoded)
+            decode(key);
+        return m_values[key];
+    }
+
+    void decode(setting::key key);
+
+    void notify();
+
+    std::array<Value, setting::count> m_values{};
+    std::map<std::string, ChangeSignal> m_signals;
+    /// observed keys set since the last notify(), with their old values
+    std::map<std::string, std::string> m_changed;
+    /// open scopes, and whether anything was changed in them
+    unsigned m_tx{0};
+    bool m_tx_changed{false};
+    TxStats m_tx_stats;
+
     struct settings_impl;
     std::unique_ptr<settings_impl> m_impl;
     default_value_callback_t m_default_callback;
@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Offline what-if simulator.
+ *
+ * Runs the ZoneController decision code, the same code behind Logic,
+ * against a RoomModel for every combination of the given parameters,
+ * with a simulated clock.  Runs share no mutable state and are spread
+ * over all cores.
+ *
+ * egt-thermostat-sim [--days N] [--threads N] [--deadband C,...]
+ *                    [--outside C,...] [--recovery MIN,...]
+ *                    [--schedule HH:MM=C,...]... [--rules FILE]
+ *
+ * egt-thermostat-sim [--rules FILE] --bench-rules N
+ *
+ * The second form times one controller evaluation with the rules repeated
+ * up to N times.
+ */
+#include "room.h"
+#include "rules.h"
+#include "schedule.h"
+#include "thermal.h"
+#include "zones.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct Config
+{
+    double deadband{1.};
+    double outside{5.};
+    /// longest early start in minutes, 0 disables adaptive recovery
+    int recovery_max{0};
+    size_t schedule{0};
+};
+
+struct Result
+{
+    /// mean and RMS of inside minus the scheduled target, in Celsius
+    double mean_error{0.};
+    double rms_error{0.};
+    /// stage starts
+    unsigned cycles{0};
+    double heat_hours{0.};
+    double cool_hours{0.};
+};
+
+static vector<string> split(const string& str, char delim)
+{
+    vector<string> res;
+    istringstream ss(str);
+    string item;
+    while (getline(ss, item, delim))
+        if (!item.empty())
+            res.push_back(item);
+    return res;
+}
+
+static vector<double> parse_list(const string& str)
+{
+    vector<double> res;
+    for (const auto& item : split(str, ','))
+        res.push_back(stod(item));
+    return res;
+}
+
+/// Parse "HH:MM=C,..." into the same program for every day of the week.
+static bool parse_schedule(const string& str, Schedule& schedule)
+{
+    vector<Schedule::Transition> transitions;
+    for (const auto& item : split(str, ','))
+    {
+        int hour = 0;
+        int minute = 0;
+        double temp = 0.;
+        if (sscanf(item.c_str(), "%d:%d=%lf", &hour, &minute, &temp) != 3)
+            return false;
+
+        for (auto dow = 0; dow < 7; ++dow)
+        {
+            Schedule::Transition t;
+            t.dow = dow;
+            t.minute = hour * 60 + minute;
+            t.target = Temperature::from_celsius(temp);
+            transitions.push_back(t);
+        }
+    }
+
+    schedule.compile(transitions);
+    return !schedule.empty();
+}
+
+static Rules::Inputs time_inputs(int week_minute, double outside)
+{
+    Rules::Inputs inputs{};
+    inputs[Rules::input::outside] = outside;
+    inputs[Rules::input::minute] = week_minute % 60;
+    inputs[Rules::input::hour] = week_minute / 60 % 24;
+    inputs[Rules::input::dow] = week_minute / Schedule::DAY_MINUTES;
+    return inputs;
+}
+
+/// The rules are a copy, apply() keeps state.
+static Result simulate(const Config& config, const Schedule& schedule,
+                       Rules rules, int days)
+{
+    using status = ZoneController::status;
+
+    const auto& table = schedule.transitions();
+    const auto outside = config.outside;
+
+    RoomModel::Parameters parameters;
+    parameters.outside = outside;
+    parameters.initial = table[schedule.active(0)].target.celsius();
+    RoomModel room(parameters);
+
+    // start well past the epoch so no stage starts out in its minimum off time
+    auto now = ZoneController::time_point() + std::chrono::hours(24);
+    ZoneController zones(1, Temperature::from_celsius(parameters.initial));
+    zones.clock([&now]() { return now; });
+
+    ZoneController::Control control;
+    control.deadband = Temperature::from_celsius(config.deadband);
+    zones.control(control);
+
+    ThermalModel model;
+    ThermalModel::Segment segment;
+    auto hours = 0.;
+
+    auto week_minute = 0;
+    if (!rules.empty())
+    {
+        zones.policies([&](ZoneController::time_point now)
+        {
+            auto inputs = time_inputs(week_minute, outside);
+            rules.apply(zones, inputs);
+            return rules.uses() & Rules::TIME_INPUTS ?
+                   now + std::chrono::minutes(1) : ZoneController::time_point();
+        });
+    }
+
+    Result result;
+    zones.on_change([&](const vector<ZoneController::Change>& changes)
+    {
+        for (const auto& change : changes)
+        {
+            if (change.fields & ZoneController::dirty::status)
+            {
+                if (zones.current_status(0) != status::off)
+                    ++result.cycles;
+                ThermalModel::transition(segment, zones.current_status(0), hours);
+            }
+
+            room.drive(zones.current_status(0) == status::heating,
+                       zones.current_status(0) == status::cooling,
+                       zones.current_fan_status(0));
+        }
+    });
+
+    double sum = 0.;
+    double sum_sq = 0.;
+    auto early = table.size();
+    const auto steps = days * Schedule::DAY_MINUTES;
+    for (auto step = 0; step < steps; ++step)
+    {
+        week_minute = step % Schedule::WEEK_MINUTES;
+        const auto index = schedule.active(week_minute);
+        const auto scheduled = table[index].target;
+        auto target = scheduled;
+
+        // the same early start ScheduleEngine makes, held until the transition
+        const auto next = (index + 1) % table.size();
+        if (next != index && early != next)
+        {
+            const auto lead = model.early_start(room.temperature(), table[next].target.celsius(),
+                                                outside, config.deadband, true, true,
+                                                config.recovery_max);
+            if (lead && lead >= schedule.until_next(week_minute))
+                early = next;
+        }
+        if (early == next)
+            target = table[next].target;
+
+        zones.change_target(0, target);
+
+        room.step(60.);
+        now += std::chrono::minutes(1);
+        hours += 1. / 60.;
+
+        const auto inside = room.temperature();
+        model.sample(segment, hours, inside, outside);
+        zones.change_current(0, Temperature::from_celsius(inside));
+        if (zones.deadline() != ZoneController::time_point() && now >= zones.deadline())
+            zones.process();
+
+        const auto error = inside - scheduled.celsius();
+        sum += std::fabs(error);
+        sum_sq += error * error;
+        if (zones.current_status(0) == status::heating)
+            result.heat_hours += 1. / 60.;
+        else if (zones.current_status(0) == status::cooling)
+            result.cool_hours += 1. / 60.;
+    }
+
+    result.mean_error = sum / steps;
+    result.rms_error = std::sqrt(sum_sq / steps);
+    return result;
+}
+
+/// Time one evaluation with the rules repeated 1, 2, 4 ... copies times.
+static int bench_rules(const string& source, int copies)
+{
+    cout << "rules,instructions,ns_per_tick" << endl;
+
+    for (auto n = 0; n <= copies; n = n ? n * 2 : 1)
+    {
+        string text;
+        for (auto i = 0; i < n; ++i)
+            text += source + "\n";
+
+        Rules rules;
+        if (!rules.compile(text))
+        {
+            cerr << rules.error() << endl;
+            return 1;
+        }
+
+        auto now = ZoneController::time_point() + std::chrono::hours(24);
+        ZoneController zones(1, Temperature::from_celsius(20.));
+        zones.clock([&now]() { return now; });
+
+        auto week_minute = 0;
+        if (n)
+        {
+            zones.policies([&](ZoneController::time_point)
+            {
+                auto inputs = time_inputs(week_minute, 10.);
+                rules.apply(zones, inputs);
+                return ZoneController::time_point();
+            });
+        }
+
+        constexpr auto ITERATIONS = 1000000;
+        const auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < ITERATIONS; ++i)
+        {
+            now += std::chrono::seconds(10);
+            week_minute = i / 6 % Schedule::WEEK_MINUTES;
+            zones.change_current(0, Temperature::from_centi(1900 + i % 200));
+        }
+        const std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        cout << n << ',' << rules.instructions() << ','
+             << std::fixed << std::setprecision(1)
+             << elapsed.count() / ITERATIONS << endl;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    auto days = 7;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    vector<double> deadbands{0.5, 1., 1.5, 2.};
+    vector<double> outsides{5.};
+    vector<double> recoveries{0., 120.};
+    vector<string> programs;
+    string source;
+    auto bench = 0;
+
+    for (auto i = 1; i < argc; ++i)
+    {
+        const string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            cerr << "missing value for " << arg << endl;
+            return 1;
+        }
+
+        const string value = argv[++i];
+        if (arg == "--days")
+            days = max(1, stoi(value));
+        else if (arg == "--threads")
+            threads = max(1, stoi(value));
+        else if (arg == "--deadband")
+            deadbands = parse_list(value);
+        else if (arg == "--outside")
+            outsides = parse_list(value);
+        else if (arg == "--recovery")
+            recoveries = parse_list(value);
+        else if (arg == "--schedule")
+            programs.push_back(value);
+        else if (arg == "--rules")
+        {
+            std::ifstream in(value);
+            if (!in)
+            {
+                cerr << "failed to open " << value << endl;
+                return 1;
+            }
+            std::stringstream ss;
+            ss << in.rdbuf();
+            source = ss.str();
+        }
+        else if (arg == "--bench-rules")
+            bench = max(1, stoi(value));
+        else
+        {
+            cerr << "unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    if (bench)
+    {
+        if (source.empty())
+            source = "when minute < 10 then fan\nwhen outside < 15 then lockout cool";
+        return bench_rules(source, bench);
+    }
+
+    Rules rules;
+    if (!rules.compile(source))
+    {
+        cerr << "rules: " << rules.error() << endl;
+        return 1;
+    }
+
+    if (programs.empty())
+        programs.push_back("6:00=21,8:00=16,18:00=21,22:00=18");
+
+    vector<Schedule> schedules(programs.size());
+    for (size_t i = 0; i < programs.size(); ++i)
+    {
+        if (!parse_schedule(programs[i], schedules[i]))
+        {
+            cerr << "invalid schedule " << programs[i] << endl;
+            return 1;
+        }
+    }
+
+    vector<Config> configs;
+    for (size_t s = 0; s < schedules.size(); ++s)
+        for (const auto deadband : deadbands)
+            for (const auto outside : outsides)
+                for (const auto recovery : recoveries)
+                {
+                    Config config;
+                    config.deadband = deadband;
+                    config.outside = outside;
+                    config.recovery_max = static_cast<int>(recovery);
+                    config.schedule = s;
+                    configs.push_back(config);
+                }
+
+    // each worker takes the next unstarted run, results land in their own slot
+    vector<Result> results(configs.size());
+    std::atomic<size_t> next{0};
+    const auto start = std::chrono::steady_clock::now();
+
+    vector<std::thread> workers;
+    threads = std::min<size_t>(threads, configs.size());
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&]()
+        {
+            for (auto i = next++; i < configs.size(); i = next++)
+                results[i] = simulate(configs[i], schedules[configs[i].schedule], rules, days);
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    cout << "schedule,deadband,outside,recovery,mean_error,rms_error,cycles,heat_hours,cool_hours" << endl;
+    cout << std::fixed;
+    for (size_t i = 0; i < configs.size(); ++i)
+    {
+        const auto& c = configs[i];
+        const auto& r = results[i];
+        cout << c.schedule << ','
+             << std::setprecision(2) << c.deadband << ',' << c.outside << ','
+             << c.recovery_max << ','
+             << std::setprecision(3) << r.mean_error << ',' << r.rms_error << ','
+             << r.cycles << ','
+             << std::setprecision(2) << r.heat_hours << ',' << r.cool_hours << endl;
+    }
+
+    cerr << configs.size() << " runs of " << days << " days in "
+         << std::setprecision(2) << elapsed.count() << "s on "
+         << threads << " threads" << endl;
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef TEMPERATURE_H
+#define TEMPERATURE_H
+
+#include <cstdint>
+
+/**
+ * Temperature stored as integer hundredths of a degree Celsius.
+ *
+ * Conversions and display rounding are integer and constexpr, so comparisons
+ * in the control path never touch floating point and stepping the setpoint by
+ * a display degree is exact.
+ */
+class Temperature
+{
+public:
+
+    using rep = int32_t;
+
+    enum class unit
+    {
+        celsius,
+        fahrenheit,
+    };
+
+    constexpr Temperature() = default;
+
+    static constexpr Temperature from_centi(rep centi)
+    {
+        return Temperature(centi);
+    }
+
+    static constexpr Temperature from_celsius(double c)
+    {
+        return Temperature(static_cast<rep>(c * 100. + (c < 0. ? -.5 : .5)));
+    }
+
+    static constexpr Temperature from_fahrenheit(double f)
+    {
+        return from_celsius((f - 32.) * 5. / 9.);
+    }
+
+    /// A whole display degree in the given unit.
+    static constexpr Temperature from_display(int degrees, unit u)
+    {
+        if (u == unit::fahrenheit)
+            return Temperature(static_cast<rep>(div_round((degrees * 100LL - 3200LL) * 5LL, 9LL)));
+        return Temperature(static_cast<rep>(degrees * 100LL));
+    }
+
+    constexpr rep centi() const { return m_centi; }
+
+    constexpr double celsius() const { return m_centi / 100.; }
+
+    constexpr double fahrenheit() const { return m_centi * 9. / 500. + 32.; }
+
+    /// Rounded whole degrees in the given unit, as shown to the user.
+    constexpr int display(unit u) const
+    {
+        if (u == unit::fahrenheit)
+            return static_cast<int>(div_round(m_centi * 9LL + 16000LL, 500LL));
+        return static_cast<int>(div_round(m_centi, 100LL));
+    }
+
+    /// Move by whole display degrees, snapping to a whole display degree.
+    constexpr Temperature step(int degrees, unit u) const
+    {
+        return from_display(display(u) + degrees, u);
+    }
+
+    constexpr bool operator==(const Temperature& rhs) const { return m_centi == rhs.m_centi; }
+    constexpr bool operator!=(const Temperature& rhs) const { return m_centi != rhs.m_centi; }
+    constexpr bool operator<(const Temperature& rhs) const { return m_centi < rhs.m_centi; }
+    constexpr bool operator>(const Temperature& rhs) const { return m_centi > rhs.m_centi; }
+    constexpr bool operator<=(const Temperature& rhs) const { return m_centi <= rhs.m_centi; }
+    constexpr bool operator>=(const Temperature& rhs) const { return m_centi >= rhs.m_centi; }
+
+    constexpr Temperature operator+(const Temperature& rhs) const { return Temperature(m_centi + rhs.m_centi); }
+    constexpr Temperature operator-(const Temperature& rhs) const { return Temperature(m_centi - rhs.m_centi); }
+
+private:
+
+    constexpr explicit Temperature(rep centi)
+        : m_centi(centi)
+    {}
+
+    /// Integer division rounding halves away from zero, like std::round().
+    static constexpr long long div_round(long long n, long long d)
+    {
+        return n >= 0 ? (n + d / 2) / d : -((-n + d / 2) / d);
+    }
+
+    rep m_centi{0};
+};
+
+static_assert(Temperature::from_celsius(20.).display(Temperature::unit::fahrenheit) == 68, "C to F");
+static_assert(Temperature::from_display(68, Temperature::unit::fahrenheit).display(Temperature::unit::celsius) == 20, "F to C");
+static_assert(Temperature::from_celsius(-0.5).display(Temperature::unit::celsius) == -1, "rounding");
+static_assert(Temperature::from_display(70, Temperature::unit::fahrenheit)
+              .step(1, Temperature::unit::fahrenheit)
+              .display(Temperature::unit::fahrenheit) == 71, "exact step");
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "thermal.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+/// forgetting factor, older observations fade over about a thousand samples
+static constexpr float LAMBDA = 0.999f;
+/// keeps the covariance bounded when the input stops varying
+static constexpr float P_MAX = 1e4f;
+/// samples further apart than this are a gap in the data
+static constexpr double MAX_GAP_HOURS = 2.;
+/// anything faster is a sensor glitch, in Celsius per hour
+static constexpr double MAX_RATE = 30.;
+
+static_assert(sizeof(ThermalModel) <= 96, "model should stay a few dozen bytes");
+
+void ThermalModel::observe(status s, double rate, double outside_delta)
+{
+    auto& f = m_fits[static_cast<size_t>(s)];
+    const auto x = static_cast<float>(outside_delta);
+    const auto y = static_cast<float>(rate);
+
+    // P * [1 x]
+    const auto px0 = f.p[0] + f.p[1] * x;
+    const auto px1 = f.p[1] + f.p[2] * x;
+    const auto denom = LAMBDA + px0 + x * px1;
+    const auto k0 = px0 / denom;
+    const auto k1 = px1 / denom;
+    const auto err = y - (f.theta[0] + f.theta[1] * x);
+
+    f.theta[0] += k0 * err;
+    f.theta[1] += k1 * err;
+    f.p[0] = std::fmin((f.p[0] - k0 * px0) / LAMBDA, P_MAX);
+    f.p[1] = (f.p[1] - k0 * px1) / LAMBDA;
+    f.p[2] = std::fmin((f.p[2] - k1 * px1) / LAMBDA, P_MAX);
+    ++f.samples;
+}
+
+void ThermalModel::sample(Segment& segment, double hours, double inside, double outside)
+{
+    const auto dt = hours - segment.hours;
+    if (segment.valid && dt > 0. && dt <= MAX_GAP_HOURS)
+    {
+        const auto rate = (inside - segment.inside) / dt;
+        if (std::fabs(rate) <= MAX_RATE)
+            observe(segment.s, rate, outside - (inside + segment.inside) / 2.);
+    }
+
+    segment.hours = hours;
+    segment.inside = inside;
+    segment.valid = true;
+}
+
+void ThermalModel::transition(Segment& segment, status s, double hours)
+{
+    // the last inside temperature is the best guess at the switch over
+    segment.s = s;
+    segment.hours = hours;
+}
+
+double ThermalModel::rate(status s, double inside, double outside) const
+{
+    const auto& f = fit(s);
+    if (f.samples < MIN_SAMPLES)
+        return 0.;
+    return f.theta[0] + f.theta[1] * (outside - inside);
+}
+
+double ThermalModel::recovery(double from, double to, double outside) const
+{
+    if (to == from)
+        return 0.;
+
+    const auto s = to > from ? status::heating : status::cooling;
+    const auto& f = fit(s);
+    if (f.samples < MIN_SAMPLES)
+        return -1.;
+
+    const double a = f.theta[0];
+    const double b = f.theta[1];
+
+    // dT/dt = a + b * (outside - T) approaches T = outside + a / b exponentially
+    if (b > 1e-3)
+    {
+        const auto eq = outside + a / b;
+        const auto ratio = (eq - from) / (eq - to);
+        if (!(ratio >= 1.))
+            return -1.;
+        return std::log(ratio) / b;
+    }
+
+    const auto r = a + b * (outside - from);
+    if ((to - from) * r <= 0.)
+        return -1.;
+    return (to - from) / r;
+}
+
+int ThermalModel::early_start(double inside, double target, double outside,
+                              double deadband, bool heat, bool cool, int most) const
+{
+    const auto half = deadband / 2.;
+    heat = heat && target > inside + half;
+    cool = cool && target < inside - half;
+    if (most <= 0 || (!heat && !cool))
+        return 0;
+
+    const auto hours = recovery(inside, target, outside);
+    if (hours < 0.)
+        return 0;
+
+    return static_cast<int>(std::min<double>(std::ceil(hours * 60.), most));
+}
+
+std::string ThermalModel::save() const
+{
+    std::ostringstream ss;
+    ss.precision(9);
+    for (const auto& f : m_fits)
+        ss << f.theta[0] << ' ' << f.theta[1] << ' '
+           << f.p[0] << ' ' << f.p[1] << ' ' << f.p[2] << ' '
+           << f.samples << ' ';
+    return ss.str();
+}
+
+bool ThermalModel::load(const std::string& str)
+{
+    std::istringstream ss(str);
+    auto fits = m_fits;
+    for (auto& f : fits)
+    {
+        if (!(ss >> f.theta[0] >> f.theta[1] >> f.p[0] >> f.p[1] >> f.p[2] >> f.samples))
+            return false;
+    }
+
+    m_fits = fits;
+    return true;
+}
+
+static size_t samples(const ThermalModel& model)
+{
+    using status = ThermalModel::status;
+    return model.fit(status::off).samples +
+           model.fit(status::cooling).samples +
+           model.fit(status::heating).samples;
+}
+
+size_t fit_history(ThermalModel& model, const std::vector<LogRecord>& records, double outside)
+{
+    constexpr double MS_PER_HOUR = 3600. * 1000.;
+
+    ThermalModel::Segment segment;
+    const auto before = samples(model);
+
+    for (const auto& r : records)
+    {
+        const auto hours = r.datetime / MS_PER_HOUR;
+        if (r.status < 0)
+            model.sample(segment, hours, r.temp, outside);
+        else if (r.status <= static_cast<int>(ThermalModel::status::heating))
+            ThermalModel::transition(segment, static_cast<ThermalModel::status>(r.status), hours);
+    }
+
+    return samples(model) - before;
+}
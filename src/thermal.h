@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef THERMAL_H
+#define THERMAL_H
+
+#include "temperature.h"
+#include "zones.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Learned thermal response of the space.
+ *
+ * For each HVAC status the rate of change of the inside temperature is
+ * fitted as rate = a + b * (outside - inside), in Celsius per hour, by
+ * recursive least squares.  Each sample costs a handful of multiplies and
+ * the whole model is a few dozen bytes.
+ */
+class ThermalModel
+{
+public:
+
+    using status = ZoneController::status;
+
+    /// Fewer observations than this and the fit is not trusted.
+    static constexpr uint32_t MIN_SAMPLES = 8;
+
+    struct Fit
+    {
+        /// a and b
+        std::array<float, 2> theta{};
+        /// covariance, upper triangle
+        std::array<float, 3> p{{100.f, 0.f, 100.f}};
+        uint32_t samples{0};
+    };
+
+    /**
+     * Inside temperature history between status changes.
+     *
+     * Kept outside the model so the model stays small and can be copied.
+     */
+    struct Segment
+    {
+        status s{status::off};
+        double hours{0.};
+        double inside{0.};
+        bool valid{false};
+    };
+
+    /// Add one observed rate.
+    void observe(status s, double rate, double outside_delta);
+
+    /// Feed an inside temperature sample at a time in hours.
+    void sample(Segment& segment, double hours, double inside, double outside);
+
+    /// Start a new segment on a status change at a time in hours.
+    static void transition(Segment& segment, status s, double hours);
+
+    /// Predicted rate in Celsius per hour, 0 if not trusted.
+    double rate(status s, double inside, double outside) const;
+
+    /**
+     * Hours needed to move from one temperature to another with the
+     * stage that heads that way running.  Negative if unknown or
+     * unreachable.
+     */
+    double recovery(double from, double to, double outside) const;
+
+    /**
+     * Minutes ahead of a transition to apply its target so the room gets
+     * there on time, no more than most.  0 if the room is within half the
+     * deadband of it, neither allowed stage heads that way, or the time is
+     * unknown.
+     */
+    int early_start(double inside, double target, double outside,
+                    double deadband, bool heat, bool cool, int most) const;
+
+    inline const Fit& fit(status s) const { return m_fits[static_cast<size_t>(s)]; }
+
+    /// Serialize for Settings.
+    std::string save() const;
+
+    /// Restore from save(), keeping the current state on error.
+    bool load(const std::string& str);
+
+protected:
+
+    std::array<Fit, 3> m_fits;
+};
+
+/// One temp_log or status_log row, as read back for fitting.
+struct LogRecord
+{
+    /// milliseconds since the Unix epoch
+    long long datetime;
+    /// Celsius, for temp_log rows
+    double temp;
+    /// status for status_log rows, -1 for temp_log rows
+    int status;
+};
+
+/// Fit a model over a log history in datetime order.  Returns the observations used.
+size_t fit_history(ThermalModel& model, const std::vector<LogRecord>& records, double outside);
+
+#endif
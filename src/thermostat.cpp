@@ -3,12 +3,20 @@
  *
  * SPDX-License-Identifier: Apache-2.0
  */
+#include "checkpoint.h"
+#include "iio.h"
 #include "logic.h"
+#include "outputs.h"
 #include "pages.h"
+#include "sampler.h"
 #include "sensors.h"
 #include "settings.h"
+#include "thermal.h"
 #include "window.h"
 #include <egt/detail/imagecache.h>
+#include <algorithm>
+#include <csignal>
+#include <egt/asio.hpp>
 #include <egt/ui>
 #include <iomanip>
 #include <iostream>
@@ -22,7 +30,7 @@ static std::string current_time()
     const auto in_time_t = std::chrono::system_clock::to_time_t(now);
     const auto local = std::localtime(&in_time_t);
     std::stringstream ss;
-    if (settings().get("time_format") == "24")
+    if (settings().integer<setting::time_format>() == 24)
         ss << std::put_time(local, "%H:%M:%S %p");
     else
         ss << std::put_time(local, "%I:%M:%S %p");
@@ -66,30 +74,94 @@ static void update_time(ThermostatWindow& win)
     }
 }
 
-int main(int argc, char** argv)
+/**
+ * Fit the thermal model over the logged history, without the UI.
+ *
+ * egt-thermostat --fit-model [--repeat N] [--save]
+ */
+static int fit_model(int argc, char** argv)
 {
-    Application app(argc, argv);
+    auto repeat = 1;
+    auto save = false;
+    for (auto i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc)
+            repeat = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--save")
+            save = true;
+    }
 
-    add_search_path(DATADIR "/egt/thermostat/");
-    add_search_path("./images");
+    const auto records = settings().log_history();
+    const auto outside = settings().real<setting::outside_temp>();
 
-    global_theme().palette().set(Palette::ColorId::bg, Color(38, 50, 56));
-    global_theme().palette().set(Palette::ColorId::bg, Color(38, 50, 56), Palette::GroupId::checked);
-    global_theme().palette().set(Palette::ColorId::bg, Color(38, 50, 56), Palette::GroupId::active);
-    global_theme().palette().set(Palette::ColorId::label_text, Palette::white);
-    global_theme().palette().set(Palette::ColorId::label_text, Palette::cyan, Palette::GroupId::active);
-    global_theme().palette().set(Palette::ColorId::label_text, Palette::cyan, Palette::GroupId::checked);
-    global_theme().palette().set(Palette::ColorId::label_bg, Color(Palette::cyan, 55), Palette::GroupId::active);
-    global_theme().palette().set(Palette::ColorId::border, Palette::cyan);
-    global_theme().palette().set(Palette::ColorId::border, Palette::cyan, Palette::GroupId::active);
-    global_theme().palette().set(Palette::ColorId::border, Palette::cyan, Palette::GroupId::checked);
-    global_theme().palette().set(Palette::ColorId::button_text, Palette::white);
-    global_theme().palette().set(Palette::ColorId::button_text, Palette::white, Palette::GroupId::disabled);
-    global_theme().palette().set(Palette::ColorId::button_bg, Color(Palette::cyan, 55), Palette::GroupId::active);
-    global_theme().palette().set(Palette::ColorId::button_bg, Color(Palette::cyan, 55), Palette::GroupId::normal);
-    global_theme().palette().set(Palette::ColorId::button_bg, Color(Palette::cyan, 55), Palette::GroupId::checked);
-    global_theme().palette().set(Palette::ColorId::button_bg, Color(Palette::black, 20), Palette::GroupId::disabled);
+    ThermalModel model;
+    size_t observations = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < repeat; ++i)
+    {
+        model = ThermalModel();
+        observations = fit_history(model, records, outside);
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
 
+    const auto total = static_cast<double>(records.size()) * repeat;
+    cout << records.size() << " records, " << observations << " observations, "
+         << std::fixed << std::setprecision(1)
+         << (elapsed.count() > 0. ? total / elapsed.count() / 1e6 : 0.)
+         << "M records/s" << endl;
+
+    for (const auto s : {Logic::status::off, Logic::status::cooling, Logic::status::heating})
+    {
+        const auto& fit = model.fit(s);
+        cout << Logic::status_str(s) << ": " << std::setprecision(3)
+             << fit.theta[0] << " + " << fit.theta[1] << " * (outside - inside) C/h, "
+             << fit.samples << " samples" << endl;
+    }
+
+    if (save)
+        settings().set("thermal_model", model.save());
+
+    return 0;
+}
+
+/**
+ * Print the logged history of the last hours, without the UI.
+ *
+ * egt-thermostat --history [HOURS]
+ */
+static int print_history(int argc, char** argv)
+{
+    auto hours = 24.;
+    for (auto i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--history" && i + 1 < argc)
+            hours = std::max(0., std::stod(argv[++i]));
+    }
+
+    const auto to = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+    const auto history = settings().history(to - static_cast<long long>(hours * 3600. * 1000.), to);
+
+    cout << history.periods.size() << " periods of "
+         << history.period / (60 * 1000) << " minutes" << endl;
+    for (const auto& p : history.periods)
+    {
+        const auto time = static_cast<time_t>(p.datetime / 1000);
+        cout << std::put_time(std::localtime(&time), "%F %R")
+             << std::fixed << std::setprecision(1);
+        if (p.samples)
+            cout << " " << p.temp_mean << "C (" << p.temp_min << " to " << p.temp_max << ")";
+        else
+            cout << " -";
+        cout << " heat: " << p.heat / 60. << "min cool: " << p.cool / 60. << "min" << endl;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
     /*
      * In some cases defaults would be defined by the database itself.  However,
      * we want to dynamically probe hardware for default values so Settings
@@ -98,12 +170,8 @@ int main(int argc, char** argv)
      */
     settings().set_default_callback([](const std::string & key) -> std::string
     {
-
-        if (key == "mode")
-            return "auto";
-        else if (key == "fan")
-            return "auto";
-        else if (key == "normal_brightness")
+        // fixed defaults are declared with their key in setting::keys
+        if (key == "normal_brightness")
             return std::to_string(Application::instance().screen()->max_brightness());
         else if (key == "sleep_brightness")
             return std::to_string(Application::instance().screen()->max_brightness() / 2);
@@ -113,24 +181,48 @@ int main(int argc, char** argv)
             if (!sensors.empty())
                 return sensors[0];
         }
-        else if (key == "outside")
-            return "on";
-        else if (key == "background")
-            return "on";
-        else if (key == "sleep_timeout")
-            return "20";
-        else if (key == "target_temp")
-            return "20";
-        else if (key == "degrees")
-            return "f";
 
         return std::string();
     });
 
+    for (auto i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--fit-model")
+            return fit_model(argc, argv);
+        if (std::string(argv[i]) == "--history")
+            return print_history(argc, argv);
+    }
+
+    Application app(argc, argv);
+
+    add_search_path(DATADIR "/egt/thermostat/");
+    add_search_path("./images");
+
+    global_theme().palette().set(Palette::ColorId::bg, Color(38, 50, 56));
+    global_theme().palette().set(Palette::ColorId::bg, Color(38, 50, 56), Palette::GroupId::checked);
+    global_theme().palette().set(Palette::ColorId::bg, Color(38, 50, 56), Palette::GroupId::active);
+    global_theme().palette().set(Palette::ColorId::label_text, Palette::white);
+    global_theme().palette().set(Palette::ColorId::label_text, Palette::cyan, Palette::GroupId::active);
+    global_theme().palette().set(Palette::ColorId::label_text, Palette::cyan, Palette::GroupId::checked);
+    global_theme().palette().set(Palette::ColorId::label_bg, Color(Palette::cyan, 55), Palette::GroupId::active);
+    global_theme().palette().set(Palette::ColorId::border, Palette::cyan);
+    global_theme().palette().set(Palette::ColorId::border, Palette::cyan, Palette::GroupId::active);
+    global_theme().palette().set(Palette::ColorId::border, Palette::cyan, Palette::GroupId::checked);
+    global_theme().palette().set(Palette::ColorId::button_text, Palette::white);
+    global_theme().palette().set(Palette::ColorId::button_text, Palette::white, Palette::GroupId::disabled);
+    global_theme().palette().set(Palette::ColorId::button_bg, Color(Palette::cyan, 55), Palette::GroupId::active);
+    global_theme().palette().set(Palette::ColorId::button_bg, Color(Palette::cyan, 55), Palette::GroupId::normal);
+    global_theme().palette().set(Palette::ColorId::button_bg, Color(Palette::cyan, 55), Palette::GroupId::checked);
+    global_theme().palette().set(Palette::ColorId::button_bg, Color(Palette::black, 20), Palette::GroupId::disabled);
+
     // set initial screen brightness
-    Application::instance().screen()->brightness(std::stoi(settings().get("normal_brightness")));
+    Application::instance().screen()->brightness(settings().integer<setting::normal_brightness>());
+
+    // control state from the last run, restored before anything can act on it
+    Checkpoint checkpoint(settings().get("checkpoint"));
+    checkpoint.load();
 
-    ThermostatWindow win;
+    ThermostatWindow win(&checkpoint);
     win.show();
 
     // update time labels periodically
@@ -142,16 +234,192 @@ int main(int argc, char** argv)
     });
     time_timer.start();
 
-    // update temp sensors periodically
-    win.m_logic.change_current(get_temp_sensor(settings().get("temp_sensor")));
-    PeriodicTimer sensor_timer(std::chrono::seconds(1));
-    sensor_timer.on_timeout([&win]()
+    // drive the HVAC outputs from their own thread, confirmed back to logic
+    HvacOutputs outputs(std::chrono::milliseconds(settings().integer<setting::hvac_dead_time>()));
+    outputs.on_confirm([&win](const HvacOutputs::Actuation & actuation)
+    {
+        win.m_logic.confirm_outputs(actuation.levels, actuation.time);
+    });
+    outputs.select(settings().get("hvac_output"));
+
+    // the simulated room behind the "fake" sensor follows the HVAC outputs
+    auto& room = sensor_registry().room(0);
+    room.parameters().speed = settings().real<setting::sim_speed>();
+    room.parameters().outside = win.m_logic.outside().celsius();
+    auto drive = [&win, &room, &outputs]()
+    {
+        const auto heat = win.m_logic.current_status() == Logic::status::heating;
+        const auto cool = win.m_logic.current_status() == Logic::status::cooling;
+        const auto fan = win.m_logic.current_fan_status();
+        outputs.set(HvacOutputs::levels(fan, heat, cool));
+        room.drive(heat, cool, fan);
+    };
+    drive();
+    win.m_logic.on_change([drive](unsigned changed)
+    {
+        if (changed & (Logic::dirty::status | Logic::dirty::fan))
+            drive();
+    });
+
+    // open the hardware at the levels already driven
+    outputs.start();
+
+    // sample the temp sensor on its own thread and feed logic from the ring
+    sensor_registry().trace_speed(settings().real<setting::trace_speed>());
+
+    SensorSampler sampler;
+    SampleFilter::Config filter;
+    filter.median = settings().integer<setting::filter_median>();
+    filter.alpha = settings().real<setting::filter_alpha>();
+    filter.deadband = settings().real<setting::filter_deadband>();
+    filter.stuck = std::chrono::minutes(settings().integer<setting::filter_stuck>());
+    sampler.filter(filter);
+    SensorSampler::Adaptive adaptive;
+    adaptive.max_period = std::chrono::seconds(settings().integer<setting::sensor_max_period>());
+    sampler.adaptive(adaptive);
+    const auto trace = settings().get("trace_record");
+    if (!trace.empty() && !sampler.record(trace))
+        cerr << "failed to open trace " << trace << endl;
+
+    // IIO devices deliver samples from the event loop instead of the sampler
+    IioSensor iio;
+    iio.filter(filter);
+    iio.on_sample([&win](const Sample & sample)
     {
-        win.m_logic.change_current(get_temp_sensor(settings().get("temp_sensor")));
+        if (sample.q == Sample::quality::good)
+            win.m_logic.change_current(Temperature::from_celsius(sample.value));
+        else
+            win.m_logic.lose_current();
     });
-    sensor_timer.start();
 
+    auto select = [&sampler, &iio](const std::string & name)
+    {
+        if (is_iio_sensor(name))
+        {
+            sampler.select({});
+            if (!iio.open(name))
+                cerr << "failed to open " << name << endl;
+        }
+        else
+        {
+            iio.close();
+            sampler.select(name);
+        }
+    };
+
+    select(settings().get("temp_sensor"));
+    settings().on_change("temp_sensor").on_event([&select](const std::string&, const std::string&)
+    {
+        select(settings().get("temp_sensor"));
+    });
+
+    // hot-plugged sensors reach the sensors page, and a selected sensor that
+    // comes back is resolved again
+    sensor_catalog().watch();
+    sensor_catalog().on_change([&select]()
+    {
+        select(settings().get("temp_sensor"));
+    });
+
+    sampler.on_sample([&win](const Sample & sample)
+    {
+        if (sample.q == Sample::quality::good)
+            win.m_logic.change_current(Temperature::from_celsius(sample.value));
+        else
+            win.m_logic.lose_current();
+    });
+    sampler.start();
+
+    // poll fast again whenever the setpoint or mode changes, or on a touch
+    sampler.threshold(win.m_logic.target().celsius());
+    win.m_logic.on_change([&win, &sampler](unsigned changed)
+    {
+        if (changed & (Logic::dirty::target | Logic::dirty::mode))
+        {
+            sampler.threshold(win.m_logic.target().celsius());
+            sampler.boost();
+        }
+    });
+    auto input_handle = Input::global_input().on_event([&sampler](Event&)
+    {
+        sampler.boost();
+    }, {EventId::raw_pointer_down});
+
+    // a service stop ends the event loop like a normal exit, so staged log
+    // rows and settings are written below.  SIGHUP is a handoff to a run
+    // started right after this one: the outputs are left as they are for it
+    // to take over from the checkpoint.
+    auto handoff = false;
+    asio::signal_set signals(app.event().io(), SIGTERM, SIGINT, SIGHUP);
+    signals.async_wait([&app, &outputs, &checkpoint, &handoff](const asio::error_code & error, int signal)
+    {
+        if (error)
+            return;
+        handoff = signal == SIGHUP && !checkpoint.path().empty();
+        outputs.hold(handoff);
+        app.event().quit();
+    });
+
+    const auto started = std::chrono::steady_clock::now();
     auto ret = app.run();
+    const std::chrono::duration<double> ran = std::chrono::steady_clock::now() - started;
+    signals.cancel();
+
+    Input::global_input().remove_handler(input_handle);
+    sensor_catalog().unwatch();
+    sampler.stop();
+    outputs.stop();
+    // the outputs are off, so the state in the checkpoint no longer holds
+    if (!handoff)
+        checkpoint.remove();
+    // settings and log rows still being written behind reach the database
+    // before exit
+    if (!settings().flush())
+        cerr << "failed to save settings" << endl;
+    cout << "sensor reads: " << sampler.stats().reads
+         << " wakeups: " << sampler.stats().wakeups
+         << " interval: " << sampler.stats().interval_ms << "ms"
+         << " errors: " << sampler.stats().errors
+         << " overruns: " << sampler.stats().overruns
+         << " max latency: " << sampler.stats().max_latency_us << "us"
+         << " passed: " << sampler.filter_stats().passed
+         << " held: " << sampler.filter_stats().held
+         << " faults: range " << sampler.filter_stats().range_faults
+         << " stuck " << sampler.filter_stats().stuck_faults
+         << " read " << sampler.filter_stats().read_faults << endl;
+
+    static const char* const OUTPUT_NAMES[] = {"fan", "heat", "cool"};
+    cout << "output writes: " << outputs.stats().writes
+         << " requests: " << outputs.stats().requests
+         << " coalesced: " << outputs.stats().coalesced
+         << " interlocks: " << outputs.stats().interlocks
+         << " conflicts: " << outputs.stats().conflicts
+         << " errors: " << outputs.stats().errors << endl;
+    for (auto i = 0; i < HvacOutputs::count; ++i)
+    {
+        const auto& latency = outputs.stats().latency[i];
+        if (latency.changes)
+            cout << OUTPUT_NAMES[i] << " changes: " << latency.changes
+                 << " latency: " << latency.total_us / static_cast<long long>(latency.changes)
+                 << "us max: " << latency.max_us << "us" << endl;
+    }
+
+    // flash wear budget of the logs
+    const auto logs = settings().log_stats();
+    cout << "log rows: " << logs.rows
+         << " (" << std::fixed << std::setprecision(2)
+         << (ran.count() > 0. ? logs.rows / ran.count() : 0.) << "/s)"
+         << " commits: " << logs.commits
+         << " bytes: " << logs.bytes
+         << " (" << (ran.count() > 0. ? logs.bytes / ran.count() : 0.) << "/s)"
+         << " dropped: " << logs.dropped
+         << " folded: " << logs.folded
+         << " expired: " << logs.expired << endl;
+
+    const auto& tx = settings().tx_stats();
+    cout << "transactions: " << tx.scopes
+         << " batches: " << tx.batches
+         << " elided: " << tx.elided << endl;
 
     Application::instance().screen()->brightness(
         Application::instance().screen()->max_brightness());
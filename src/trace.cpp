@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "trace.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char TRACE_MAGIC[4] = {'E', 'G', 'T', 'T'};
+static const uint32_t TRACE_VERSION = 1;
+
+TraceReplay::TraceReplay(const std::string& path)
+{
+    open(path);
+}
+
+bool TraceReplay::open(const std::string& path)
+{
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st {};
+    if (::fstat(fd, &st) < 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(TraceHeader) + sizeof(TraceRecord))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const auto header = static_cast<const TraceHeader*>(map);
+    if (std::memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+        header->version != TRACE_VERSION)
+    {
+        ::munmap(map, st.st_size);
+        return false;
+    }
+
+    ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    m_map = map;
+    m_length = st.st_size;
+    m_records = reinterpret_cast<const TraceRecord*>(header + 1);
+    m_count = (m_length - sizeof(TraceHeader)) / sizeof(TraceRecord);
+    m_pos = 0;
+    m_started = false;
+
+    return true;
+}
+
+void TraceReplay::close()
+{
+    if (m_map)
+        ::munmap(m_map, m_length);
+
+    m_map = nullptr;
+    m_length = 0;
+    m_records = nullptr;
+    m_count = 0;
+}
+
+bool TraceReplay::sample(std::chrono::steady_clock::time_point now, double& value)
+{
+    if (!m_count)
+        return false;
+
+    if (m_speed <= 0.)
+    {
+        if (m_pos >= m_count)
+            m_pos = 0;
+        const auto& record = m_records[m_pos++];
+        value = record.value;
+        return record.flags == 0;
+    }
+
+    if (!m_started || m_pos >= m_count)
+    {
+        m_start = now;
+        m_offset_us = m_records[0].time_us;
+        m_pos = 0;
+        m_started = true;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - m_start).count();
+    const auto position = m_offset_us + static_cast<int64_t>(elapsed * m_speed);
+
+    while (m_pos + 1 < m_count && m_records[m_pos + 1].time_us <= position)
+        ++m_pos;
+
+    const auto& record = m_records[m_pos];
+    value = record.value;
+
+    // past the last record, start over on the next sample
+    if (m_pos + 1 == m_count && position > record.time_us)
+        m_pos = m_count;
+
+    return record.flags == 0;
+}
+
+TraceReplay::~TraceReplay()
+{
+    close();
+}
+
+bool TraceRecorder::open(const std::string& path)
+{
+    close();
+
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+        return false;
+
+    struct stat st {};
+    if (::fstat(m_fd, &st) < 0)
+    {
+        close();
+        return false;
+    }
+
+    m_offset_us = 0;
+    m_started = false;
+
+    // a crash while the header was written leaves less than one, start over
+    const auto size = static_cast<size_t>(st.st_size);
+    if (size < sizeof(TraceHeader) && ::ftruncate(m_fd, 0) < 0)
+    {
+        close();
+        return false;
+    }
+
+    if (size < sizeof(TraceHeader))
+    {
+        TraceHeader header{};
+        std::memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header.version = TRACE_VERSION;
+        if (::write(m_fd, &header, sizeof(header)) != sizeof(header))
+        {
+            close();
+            return false;
+        }
+    }
+    else
+    {
+        TraceHeader header{};
+        if (::pread(m_fd, &header, sizeof(header), 0) != sizeof(header) ||
+            std::memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+            header.version != TRACE_VERSION)
+        {
+            close();
+            return false;
+        }
+
+        // a crash in the middle of an append leaves a torn record at the
+        // end, cut it off so the records appended after it stay aligned
+        const auto records = (size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+        const auto whole = sizeof(TraceHeader) + records * sizeof(TraceRecord);
+        if (size != whole && ::ftruncate(m_fd, static_cast<off_t>(whole)) < 0)
+        {
+            close();
+            return false;
+        }
+
+        // continue the time line after the last record already in the file
+        TraceRecord last{};
+        if (records &&
+            ::pread(m_fd, &last, sizeof(last),
+                    sizeof(TraceHeader) + (records - 1) * sizeof(TraceRecord)) == sizeof(last))
+            m_offset_us = last.time_us + 1;
+    }
+
+    return true;
+}
+
+void TraceRecorder::close()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+bool TraceRecorder::append(std::chrono::steady_clock::time_point time, double value, uint32_t flags)
+{
+    if (m_fd < 0)
+        return false;
+
+    if (!m_started)
+    {
+        m_start = time;
+        m_started = true;
+    }
+
+    TraceRecord record{};
+    record.time_us = m_offset_us +
+                     std::chrono::duration_cast<std::chrono::microseconds>(time - m_start).count();
+    record.value = static_cast<float>(value);
+    record.flags = flags;
+
+    return ::write(m_fd, &record, sizeof(record)) == sizeof(record);
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    close();
+}
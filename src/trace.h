@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Sensor trace file format.
+ *
+ * A TraceHeader followed by fixed size TraceRecord entries in time order.
+ * All fields are host endian.
+ */
+struct TraceHeader
+{
+    char magic[4];
+    uint32_t version;
+    int64_t reserved;
+};
+
+struct TraceRecord
+{
+    /// microseconds since the start of the trace
+    int64_t time_us;
+    float value;
+    /// 0 for a good reading, otherwise the Sample::quality of a failed one
+    uint32_t flags;
+};
+
+static_assert(sizeof(TraceHeader) == 16, "unexpected trace header size");
+static_assert(sizeof(TraceRecord) == 16, "unexpected trace record size");
+
+/**
+ * Replays a recorded trace from a memory mapped file.
+ *
+ * A speed of 1 replays in real time, larger values replay faster, and 0
+ * returns the next record on every sample regardless of time, as fast as
+ * the reader asks.  Replay wraps around at the end of the trace.  Records
+ * of failed reads replay as failed reads.
+ */
+class TraceReplay
+{
+public:
+
+    TraceReplay() = default;
+
+    explicit TraceReplay(const std::string& path);
+
+    TraceReplay(const TraceReplay&) = delete;
+    TraceReplay& operator=(const TraceReplay&) = delete;
+
+    bool open(const std::string& path);
+
+    void close();
+
+    inline bool is_open() const { return m_records != nullptr; }
+
+    inline void speed(double speed) { m_speed = speed; }
+
+    /// Value of the trace at a real time point, scaled by the speed.  False
+    /// where the recorded read failed.
+    bool sample(std::chrono::steady_clock::time_point now, double& value);
+
+    inline const TraceRecord* begin() const { return m_records; }
+    inline const TraceRecord* end() const { return m_records + m_count; }
+    inline size_t size() const { return m_count; }
+
+    virtual ~TraceReplay();
+
+protected:
+
+    void* m_map{nullptr};
+    size_t m_length{0};
+    const TraceRecord* m_records{nullptr};
+    size_t m_count{0};
+    size_t m_pos{0};
+    double m_speed{1.};
+    int64_t m_offset_us{0};
+    std::chrono::steady_clock::time_point m_start;
+    bool m_started{false};
+};
+
+/**
+ * Appends samples to a trace file.
+ *
+ * Each append is one write() of a record built on the stack.  Opening an
+ * existing trace cuts off a record torn by a crash, so appends stay aligned.
+ */
+class TraceRecorder
+{
+public:
+
+    TraceRecorder() = default;
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    bool open(const std::string& path);
+
+    void close();
+
+    inline bool is_open() const { return m_fd >= 0; }
+
+    bool append(std::chrono::steady_clock::time_point time, double value, uint32_t flags = 0);
+
+    virtual ~TraceRecorder();
+
+protected:
+
+    int m_fd{-1};
+    int64_t m_offset_us{0};
+    std::chrono::steady_clock::time_point m_start;
+    bool m_started{false};
+};
+
+#endif
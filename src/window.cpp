@@ -6,13 +6,27 @@
 #include "pages.h"
 #include "settings.h"
 #include "window.h"
+#include <algorithm>
 #include <chrono>
+#include <egt/asio.hpp>
 
 using namespace egt;
 using namespace std;
 
-ThermostatWindow::ThermostatWindow()
+ThermostatWindow::ThermostatWindow(Checkpoint* checkpoint)
+    : m_logic(checkpoint)
 {
+    // notify listeners once per event loop pass with everything that changed,
+    // all in one settings transaction
+    m_logic.defer([](std::function<void()> flush)
+    {
+        asio::post(Application::instance().event().io(), [flush = std::move(flush)]()
+        {
+            Settings::AutoTransaction tx(settings());
+            flush();
+        });
+    });
+
     auto hsizer = make_shared<BoxSizer>(Orientation::horizontal);
     add(expand(hsizer));
 
@@ -46,11 +60,10 @@ ThermostatWindow::ThermostatWindow()
 
     m_screen_brightness_timer.on_timeout([]()
     {
-        const auto brightness = settings().get("sleep_brightness");
-        Application::instance().screen()->brightness(std::stoi(brightness));
+        Application::instance().screen()->brightness(settings().integer<setting::sleep_brightness>());
     });
 
-    m_idle_timer.change_duration(std::chrono::seconds(std::stoi(settings().get("sleep_timeout"))));
+    m_idle_timer.change_duration(std::chrono::seconds(settings().integer<setting::sleep_timeout>()));
     m_idle_timer.on_timeout([this]()
     {
         this->idle();
@@ -58,12 +71,17 @@ ThermostatWindow::ThermostatWindow()
     });
     m_idle_timer.start();
 
+    settings().on_change("sleep_timeout").on_event([this](const std::string&, const std::string&)
+    {
+        m_idle_timer.change_duration(std::chrono::seconds(settings().integer<setting::sleep_timeout>()));
+    });
+
     // on any input, reset idle timer
     m_handle = Input::global_input().on_event([this, main_page](Event & event)
     {
         m_screen_brightness_timer.cancel();
         auto screen = Application::instance().screen();
-        screen->brightness(std::stoi(settings().get("normal_brightness")));
+        screen->brightness(settings().integer<setting::normal_brightness>());
         m_idle_timer.start();
     }, {EventId::raw_pointer_down,
         EventId::raw_pointer_up,
@@ -71,17 +89,45 @@ ThermostatWindow::ThermostatWindow()
         EventId::pointer_hold
        });
 
-    m_logic.on_logic_change([this]()
+    m_logic.zones().on_change([this](const std::vector<ZoneController::Change>& changes)
     {
-        if (settings().get("sql_logs") == "on")
-            settings().status_log(m_logic.current_status(), m_logic.current_fan_status());
+        if (!settings().flag<setting::sql_logs>())
+            return;
+
+        const auto& zones = m_logic.zones();
+        for (const auto& change : changes)
+        {
+            if (change.fields & (Logic::dirty::status | Logic::dirty::fan))
+                settings().status_log(zones.current_status(change.zone),
+                                      zones.current_fan_status(change.zone),
+                                      change.zone);
+        }
     });
 
-    m_logic.on_temperature_change([this]()
+    m_logic.on_change([this](unsigned changed)
     {
-        if (settings().get("sql_logs") == "on")
+        if (settings().flag<setting::sql_logs>() && (changed & Logic::dirty::current) &&
+            m_logic.current_valid())
             settings().temp_log(m_logic.current());
     });
+
+    // re-evaluate when a minimum on/off time or the fan overrun expires
+    m_control_timer.on_timeout([this]()
+    {
+        m_logic.process();
+    });
+
+    m_logic.on_deadline_change([this]()
+    {
+        m_control_timer.cancel();
+        if (m_logic.deadline() != Logic::time_point())
+        {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                       m_logic.deadline() - std::chrono::steady_clock::now());
+            m_control_timer.change_duration(std::max(remaining, std::chrono::milliseconds(1)));
+            m_control_timer.start();
+        }
+    });
 }
 
 void ThermostatWindow::idle()
@@ -7,6 +7,7 @@
 #define WINDOW_H
 
 #include "logic.h"
+#include "scheduler.h"
 #include <egt/ui>
 #include <map>
 #include <memory>
@@ -17,7 +18,8 @@ class ThermostatWindow : public egt::TopWindow
 {
 public:
 
-    ThermostatWindow();
+    /// Logic resumes from checkpoint, see Logic::Logic().
+    explicit ThermostatWindow(Checkpoint* checkpoint = nullptr);
 
     void idle();
 
@@ -32,9 +34,11 @@ public:
     std::shared_ptr<egt::Notebook> notebook;
     std::map<std::string, std::shared_ptr<egt::NotebookTab>> m_pages;
     Logic m_logic;
+    ScheduleEngine m_schedule{m_logic};
     std::deque<std::string> m_queue;
     egt::Timer m_screen_brightness_timer{std::chrono::seconds(5)};
     egt::PeriodicTimer m_idle_timer;
+    egt::Timer m_control_timer;
     egt::Object::RegisterHandle m_handle{0};
 
     virtual ~ThermostatWindow();
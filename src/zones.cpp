@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "zones.h"
+#include <algorithm>
+
+using namespace std;
+
+template<class Rep, class Period>
+static inline ZoneController::time_point::rep to_ticks(std::chrono::duration<Rep, Period> d)
+{
+    return std::chrono::duration_cast<ZoneController::time_point::duration>(d).count();
+}
+
+ZoneController::ZoneController(size_t zones, Temperature target)
+{
+    resize(zones, target);
+}
+
+void ZoneController::resize(size_t zones, Temperature target)
+{
+    if (zones < size())
+    {
+        // forget pending changes of removed zones
+        m_changed.erase(std::remove_if(m_changed.begin(), m_changed.end(),
+                                       [zones](uint32_t zone) { return zone >= zones; }),
+                        m_changed.end());
+    }
+
+    m_current.resize(zones, 0);
+    m_sampled.resize(zones, false);
+    m_target.resize(zones, target.centi());
+    m_mode.resize(zones, static_cast<uint8_t>(mode::automatic));
+    m_fan_mode.resize(zones, static_cast<uint8_t>(fanmode::automatic));
+    m_status.resize(zones, static_cast<uint8_t>(status::off));
+    m_fan.resize(zones, false);
+    m_policy.resize(zones, 0);
+    m_since.resize(zones, 0);
+    m_heat_off.resize(zones, 0);
+    m_cool_off.resize(zones, 0);
+    m_fan_until.resize(zones, 0);
+    m_dirty.resize(zones, 0);
+}
+
+void ZoneController::defer(defer_function defer)
+{
+    m_defer = std::move(defer);
+}
+
+void ZoneController::clock(clock_function clock)
+{
+    m_clock = std::move(clock);
+}
+
+void ZoneController::control(const Control& control)
+{
+    m_control = control;
+}
+
+void ZoneController::policies(policy_function update)
+{
+    m_policy_function = std::move(update);
+}
+
+void ZoneController::change_target(size_t zone, Temperature value)
+{
+    if (m_target[zone] != value.centi())
+    {
+        m_target[zone] = value.centi();
+        mark(zone, dirty::target);
+        process();
+    }
+}
+
+void ZoneController::change_current(size_t zone, Temperature value)
+{
+    if (m_current[zone] != value.centi() || !m_sampled[zone])
+    {
+        m_current[zone] = value.centi();
+        m_sampled[zone] = true;
+        mark(zone, dirty::current);
+        process();
+    }
+}
+
+void ZoneController::lose_current(size_t zone)
+{
+    if (m_sampled[zone])
+    {
+        m_sampled[zone] = false;
+        mark(zone, dirty::current);
+        process();
+    }
+}
+
+void ZoneController::set_mode(size_t zone, mode m)
+{
+    if (m_mode[zone] != static_cast<uint8_t>(m))
+    {
+        m_mode[zone] = static_cast<uint8_t>(m);
+        mark(zone, dirty::mode);
+        process();
+    }
+}
+
+void ZoneController::set_fan_mode(size_t zone, fanmode m)
+{
+    if (m_fan_mode[zone] != static_cast<uint8_t>(m))
+    {
+        m_fan_mode[zone] = static_cast<uint8_t>(m);
+        mark(zone, dirty::fan);
+        process();
+    }
+}
+
+std::vector<ZoneController::Snapshot> ZoneController::snapshot() const
+{
+    const auto now = m_clock().time_since_epoch().count();
+    const auto age = [now](ticks t)
+    {
+        return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                        time_point::duration(now - t)).count());
+    };
+
+    std::vector<Snapshot> zones(size());
+    for (size_t i = 0; i < size(); ++i)
+    {
+        auto& z = zones[i];
+        z = Snapshot{};
+        z.since = age(m_since[i]);
+        z.heat_off = age(m_heat_off[i]);
+        z.cool_off = age(m_cool_off[i]);
+        z.fan_until = age(m_fan_until[i]);
+        z.current = m_current[i];
+        z.sampled = m_sampled[i];
+        z.target = m_target[i];
+        z.mode = m_mode[i];
+        z.fan_mode = m_fan_mode[i];
+        z.status = m_status[i];
+        z.fan = m_fan[i];
+    }
+    return zones;
+}
+
+void ZoneController::restore(const std::vector<Snapshot>& zones, std::chrono::milliseconds elapsed)
+{
+    resize(zones.size());
+
+    const auto now = m_clock().time_since_epoch().count();
+    const auto at = [now, elapsed](int64_t age)
+    {
+        return now - to_ticks(std::chrono::milliseconds(age) + elapsed);
+    };
+
+    for (size_t i = 0; i < zones.size(); ++i)
+    {
+        const auto& z = zones[i];
+        m_since[i] = at(z.since);
+        m_heat_off[i] = at(z.heat_off);
+        m_cool_off[i] = at(z.cool_off);
+        m_fan_until[i] = at(z.fan_until);
+        m_current[i] = z.current;
+        m_sampled[i] = z.sampled != 0;
+        m_target[i] = z.target;
+        m_mode[i] = std::min<uint8_t>(z.mode, static_cast<uint8_t>(mode::heating));
+        m_fan_mode[i] = std::min<uint8_t>(z.fan_mode, static_cast<uint8_t>(fanmode::automatic));
+        m_status[i] = std::min<uint8_t>(z.status, static_cast<uint8_t>(status::heating));
+        m_fan[i] = z.fan != 0;
+        mark(i, dirty::all & ~dirty::outputs);
+    }
+
+    m_stale = true;
+}
+
+void ZoneController::touch(size_t zone, unsigned fields)
+{
+    mark(zone, fields);
+    request();
+}
+
+void ZoneController::mark(size_t zone, unsigned fields)
+{
+    if (!m_dirty[zone] && fields)
+        m_changed.push_back(static_cast<uint32_t>(zone));
+    m_dirty[zone] |= fields;
+}
+
+void ZoneController::process()
+{
+    m_stale = true;
+    request();
+}
+
+void ZoneController::request()
+{
+    if (!m_defer)
+    {
+        flush();
+        return;
+    }
+
+    if (!m_scheduled)
+    {
+        m_scheduled = true;
+        m_defer([this]() { flush(); });
+    }
+}
+
+void ZoneController::flush()
+{
+    m_scheduled = false;
+    if (m_stale)
+        evaluate();
+    dispatch();
+}
+
+void ZoneController::tick()
+{
+    evaluate();
+    dispatch();
+}
+
+void ZoneController::dispatch()
+{
+    if (m_changed.empty())
+        return;
+
+    // listeners may change zones again, so hand them a snapshot
+    std::vector<Change> changes;
+    changes.reserve(m_changed.size());
+    for (const auto zone : m_changed)
+    {
+        changes.push_back({zone, m_dirty[zone]});
+        m_dirty[zone] = 0;
+    }
+    m_changed.clear();
+
+    on_change.invoke(changes);
+}
+
+void ZoneController::evaluate()
+{
+    m_stale = false;
+
+    const auto clock = m_clock();
+    const auto now = clock.time_since_epoch().count();
+
+    ticks deadline = 0;
+    if (m_policy_function)
+        deadline = m_policy_function(clock).time_since_epoch().count();
+
+    const auto half = m_control.deadband.centi() / 2;
+    const auto heat_on = to_ticks(m_control.heat.min_on);
+    const auto heat_rest = to_ticks(m_control.heat.min_off);
+    const auto cool_on = to_ticks(m_control.cool.min_on);
+    const auto cool_rest = to_ticks(m_control.cool.min_off);
+    const auto overrun = to_ticks(m_control.fan_overrun);
+
+    constexpr auto OFF = static_cast<uint8_t>(status::off);
+    constexpr auto COOLING = static_cast<uint8_t>(status::cooling);
+    constexpr auto HEATING = static_cast<uint8_t>(status::heating);
+    constexpr auto MODE_OFF = static_cast<uint8_t>(mode::off);
+    constexpr auto MODE_AUTO = static_cast<uint8_t>(mode::automatic);
+    constexpr auto MODE_COOL = static_cast<uint8_t>(mode::cooling);
+    constexpr auto MODE_HEAT = static_cast<uint8_t>(mode::heating);
+    constexpr auto FAN_ON = static_cast<uint8_t>(fanmode::on);
+
+    const auto current = m_current.data();
+    const auto sampled = m_sampled.data();
+    const auto target = m_target.data();
+    const auto modes = m_mode.data();
+    const auto fan_modes = m_fan_mode.data();
+    const auto statuses = m_status.data();
+    const auto fans = m_fan.data();
+    const auto zone_policy = m_policy.data();
+    const auto since = m_since.data();
+    const auto heat_off = m_heat_off.data();
+    const auto cool_off = m_cool_off.data();
+    const auto fan_until = m_fan_until.data();
+
+    const auto zones = size();
+    for (size_t i = 0; i < zones; ++i)
+    {
+        const auto st = statuses[i];
+        const auto md = modes[i];
+        const auto pol = zone_policy[i];
+
+        // a running stage keeps running until it is past the other edge of the band
+        // nothing to go on before the first sample
+        const bool heat = sampled[i] && !(pol & policy::no_heat) &&
+                          current[i] < target[i] + (st == HEATING ? half : -half);
+        const bool cool = sampled[i] && !(pol & policy::no_cool) &&
+                          current[i] > target[i] - (st == COOLING ? half : -half);
+        const auto want = heat && (md == MODE_AUTO || md == MODE_HEAT) ? HEATING :
+                          cool && (md == MODE_AUTO || md == MODE_COOL) ? COOLING : OFF;
+
+        auto next = st;
+        ticks hold = 0;
+        if (want != st)
+        {
+            // a running stage finishes its minimum on time, unless the zone
+            // is turned off, and always stops before switching over
+            const auto until = st != OFF ?
+                               since[i] + (st == COOLING ? cool_on : heat_on) :
+                               want == COOLING ? cool_off[i] + cool_rest : heat_off[i] + heat_rest;
+            const auto ready = now >= until || (st != OFF && md == MODE_OFF);
+            next = ready ? (st != OFF ? OFF : want) : st;
+            hold = ready ? 0 : until;
+        }
+
+        if (next != st)
+        {
+            heat_off[i] = st == HEATING ? now : heat_off[i];
+            cool_off[i] = st == COOLING ? now : cool_off[i];
+            fan_until[i] = next == OFF ? now + overrun : fan_until[i];
+            since[i] = now;
+        }
+
+        const bool run = next != OFF || fan_modes[i] == FAN_ON || (pol & policy::fan);
+        const bool overrunning = !run && now < fan_until[i];
+        if (overrunning && (!hold || fan_until[i] < hold))
+            hold = fan_until[i];
+        const uint8_t fan = run || overrunning;
+
+        const unsigned changed = (next != st ? dirty::status : 0u) |
+                                 (fan != fans[i] ? dirty::fan : 0u);
+        statuses[i] = next;
+        fans[i] = fan;
+        if (changed)
+            mark(i, changed);
+
+        if (hold && (!deadline || hold < deadline))
+            deadline = hold;
+    }
+
+    if (deadline != m_deadline)
+    {
+        m_deadline = deadline;
+        on_deadline_change.invoke();
+    }
+}
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZONES_H
+#define ZONES_H
+
+#include "temperature.h"
+#include <chrono>
+#include <cstdint>
+#include <egt/signal.h>
+#include <functional>
+#include <vector>
+
+/**
+ * Thermostat control for any number of zones.
+ *
+ * Per zone state is kept as a structure of arrays so process() is a single
+ * branch-light pass over contiguous memory, whatever the number of zones.
+ * Only the zones that changed are reported, with a mask of what changed.
+ */
+class ZoneController
+{
+public:
+
+    enum class mode : uint8_t
+    {
+        off,
+        automatic,
+        cooling,
+        heating,
+    };
+
+    enum class fanmode : uint8_t
+    {
+        on,
+        automatic,
+    };
+
+    enum class status : uint8_t
+    {
+        off,
+        cooling,
+        heating,
+    };
+
+    using time_point = std::chrono::steady_clock::time_point;
+    using clock_function = std::function<time_point()>;
+    using defer_function = std::function<void(std::function<void()>)>;
+    /**
+     * Called at the start of every evaluation to update zone policies, see
+     * set_policy().  Returns when the policies need evaluating again even if
+     * nothing changes, time_point() if only on change.
+     */
+    using policy_function = std::function<time_point(time_point now)>;
+
+    /// Minimum run and rest times of a heating or cooling stage.
+    struct Stage
+    {
+        std::chrono::seconds min_on{0};
+        std::chrono::seconds min_off{0};
+    };
+
+    /**
+     * Control layer parameters, shared by all zones.
+     *
+     * A stage starts when the temperature is half the deadband past the
+     * target and runs until it is half the deadband past the other side.
+     */
+    struct Control
+    {
+        Temperature deadband{Temperature::from_celsius(1.)};
+        Stage heat{std::chrono::minutes(2), std::chrono::minutes(3)};
+        Stage cool{std::chrono::minutes(3), std::chrono::minutes(5)};
+        /// fan run time after a stage stops
+        std::chrono::seconds fan_overrun{std::chrono::minutes(1)};
+    };
+
+    /// Bits of Change::fields.
+    struct dirty
+    {
+        enum : unsigned
+        {
+            status = 1 << 0,
+            fan = 1 << 1,
+            target = 1 << 2,
+            current = 1 << 3,
+            mode = 1 << 4,
+            /// outputs confirmed by the driver, only reported through touch()
+            outputs = 1 << 5,
+            all = (1 << 6) - 1,
+        };
+    };
+
+    /// Bits of a zone policy, overriding the mode and fan mode.
+    struct policy
+    {
+        enum : unsigned
+        {
+            /// run the fan
+            fan = 1 << 0,
+            /// do not start, or stop, heating
+            no_heat = 1 << 1,
+            /// do not start, or stop, cooling
+            no_cool = 1 << 2,
+        };
+    };
+
+    struct Change
+    {
+        uint32_t zone;
+        unsigned fields;
+    };
+
+    /**
+     * Control state of one zone, for a checkpoint.
+     *
+     * Times are milliseconds before the snapshot was taken, negative for
+     * times still to come, so they carry over to another clock.
+     */
+    struct Snapshot
+    {
+        int64_t since;
+        int64_t heat_off;
+        int64_t cool_off;
+        int64_t fan_until;
+        Temperature::rep current;
+        Temperature::rep target;
+        uint8_t mode;
+        uint8_t fan_mode;
+        uint8_t status;
+        uint8_t fan;
+        uint8_t sampled;
+        uint8_t reserved[3];
+    };
+
+    /**
+     * Invoked with every zone that changed since the last invocation.
+     *
+     * @note The application runs this inside a settings transaction, do not
+     * start one on callback.
+     */
+    egt::Signal<const std::vector<Change>&> on_change;
+
+    /// Invoked when deadline() changes.
+    egt::Signal<> on_deadline_change;
+
+    explicit ZoneController(size_t zones = 1, Temperature target = {});
+
+    ZoneController(const ZoneController&) = delete;
+    ZoneController& operator=(const ZoneController&) = delete;
+
+    inline size_t size() const { return m_current.size(); }
+
+    /// Add or remove zones at the end.  New zones start idle at target.
+    void resize(size_t zones, Temperature target = {});
+
+    /**
+     * Set how evaluation and change notifications are deferred, for example
+     * by posting to the event loop.  Without one, every change is evaluated
+     * and reported before the call that made it returns.
+     */
+    void defer(defer_function defer);
+
+    /// Replace the clock used for all control timing, for example in tests.
+    void clock(clock_function clock);
+
+    void control(const Control& control);
+
+    /// Set the function that updates zone policies before every evaluation.
+    void policies(policy_function update);
+
+    inline const Control& control() const { return m_control; }
+
+    inline time_point now() const { return m_clock(); }
+
+    /**
+     * Earliest time at which any zone needs to be evaluated again even if
+     * nothing changes.  time_point() if none.
+     */
+    inline time_point deadline() const { return time_point(time_point::duration(m_deadline)); }
+
+    void change_target(size_t zone, Temperature value);
+
+    inline Temperature target(size_t zone) const { return Temperature::from_centi(m_target[zone]); }
+
+    void change_current(size_t zone, Temperature value);
+
+    inline Temperature current(size_t zone) const { return Temperature::from_centi(m_current[zone]); }
+
+    /**
+     * Forget the current temperature of a zone, for example on a sensor
+     * fault.  The zone stops heating and cooling, once past its minimum on
+     * time, until the next change_current().
+     */
+    void lose_current(size_t zone);
+
+    /// True while the zone has a current temperature to go on.
+    inline bool sampled(size_t zone) const { return m_sampled[zone]; }
+
+    void set_mode(size_t zone, mode m);
+
+    inline mode get_mode(size_t zone) const { return static_cast<mode>(m_mode[zone]); }
+
+    void set_fan_mode(size_t zone, fanmode m);
+
+    inline fanmode get_fan_mode(size_t zone) const { return static_cast<fanmode>(m_fan_mode[zone]); }
+
+    inline status current_status(size_t zone) const { return static_cast<status>(m_status[zone]); }
+
+    inline bool current_fan_status(size_t zone) const { return m_fan[zone]; }
+
+    /**
+     * Set the policy of a zone.  Takes effect on the next evaluation, so
+     * outside of a policy_function call process() after changing it.
+     */
+    inline void set_policy(size_t zone, unsigned flags) { m_policy[zone] = static_cast<uint8_t>(flags); }
+
+    inline unsigned get_policy(size_t zone) const { return m_policy[zone]; }
+
+    /// State of every zone, see Snapshot.
+    std::vector<Snapshot> snapshot() const;
+
+    /**
+     * Resume from a snapshot() taken elapsed ago, resizing to match.  Every
+     * field is reported as changed, and the zones are evaluated on the next
+     * process().
+     */
+    void restore(const std::vector<Snapshot>& zones, std::chrono::milliseconds elapsed);
+
+    /// Report fields of a zone as changed without changing them.
+    void touch(size_t zone, unsigned fields);
+
+    /// Evaluate all zones, now or on the next deferral.
+    void process();
+
+    /// Evaluate all zones and report what changed, immediately.
+    void tick();
+
+    virtual ~ZoneController() = default;
+
+protected:
+
+    using ticks = time_point::rep;
+
+    void evaluate();
+
+    void mark(size_t zone, unsigned fields);
+
+    void request();
+
+    void flush();
+
+    void dispatch();
+
+    std::vector<Temperature::rep> m_current;
+    /// zones with a current temperature to go on
+    std::vector<uint8_t> m_sampled;
+    std::vector<Temperature::rep> m_target;
+    std::vector<uint8_t> m_mode;
+    std::vector<uint8_t> m_fan_mode;
+    std::vector<uint8_t> m_status;
+    std::vector<uint8_t> m_fan;
+    std::vector<uint8_t> m_policy;
+    /// when the current status started
+    std::vector<ticks> m_since;
+    /// when heating and cooling last stopped
+    std::vector<ticks> m_heat_off;
+    std::vector<ticks> m_cool_off;
+    std::vector<ticks> m_fan_until;
+    std::vector<uint8_t> m_dirty;
+
+    /// zones with any dirty bits, in the order they changed
+    std::vector<uint32_t> m_changed;
+    bool m_stale{false};
+    bool m_scheduled{false};
+
+    defer_function m_defer;
+    clock_function m_clock{std::chrono::steady_clock::now};
+    policy_function m_policy_function;
+    Control m_control;
+    ticks m_deadline{0};
+};
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <iostream>
+
+/// Failed checks so far, the exit status of a test.
+inline int& check_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+/// Report a failed condition and carry on, unlike assert() also with NDEBUG.
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+            ++check_failures(); \
+        } \
+    } while (0)
+
+#endif
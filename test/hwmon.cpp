@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "check.h"
+#include "sensors.h"
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static void write(const fs::path& path, const char* value)
+{
+    fs::create_directories(path.parent_path());
+    ofstream out(path);
+    out << value;
+}
+
+static bool near(double a, double b)
+{
+    return std::fabs(a - b) < 1e-9;
+}
+
+/// HwmonSensors against a fake hwmon class directory.
+static void hwmon(const fs::path& root)
+{
+    write(root / "hwmon0" / "name", "cpu\n");
+    write(root / "hwmon0" / "temp1_input", "21500\n");
+    write(root / "hwmon0" / "temp1_label", "core\n");
+    write(root / "hwmon0" / "temp2_input", "-1250\n");
+    write(root / "hwmon1" / "temp1_input", "bogus\n");
+
+    HwmonSensors sensors(root.string());
+    CHECK(sensors.size() == 3);
+    CHECK(sensors.find("hwmon:hwmon0/temp1") == 0);
+    CHECK(sensors.find("hwmon:hwmon0/temp2") == 1);
+    CHECK(sensors.find("hwmon:hwmon1/temp1") == 2);
+    CHECK(sensors.find("hwmon:hwmon0/temp3") == -1);
+
+    double value = 0;
+    CHECK(sensors.read(0, value) && near(value, 21.5));
+    CHECK(sensors.read(1, value) && near(value, -1.25));
+    CHECK(!sensors.read(2, value));
+    CHECK(!sensors.read(3, value));
+
+    // the same open file reads the new value
+    write(root / "hwmon0" / "temp1_input", "22000\n");
+    CHECK(sensors.read(0, value) && near(value, 22.));
+
+    double values[3] = {};
+    CHECK(sensors.read_all(values, 3) == 2);
+    CHECK(near(values[0], 22.) && near(values[1], -1.25));
+
+    CHECK(!sensors.scan());
+
+    // indexes stay stable as channels come and go
+    fs::remove_all(root / "hwmon1");
+    CHECK(sensors.scan());
+    CHECK(sensors.size() == 3);
+    CHECK(!sensors.read(2, value));
+
+    write(root / "hwmon2" / "temp1_input", "30000\n");
+    write(root / "hwmon1" / "temp1_input", "25000\n");
+    CHECK(sensors.scan());
+    CHECK(sensors.size() == 4);
+    CHECK(sensors.find("hwmon:hwmon1/temp1") == 2);
+    CHECK(sensors.find("hwmon:hwmon2/temp1") == 3);
+    CHECK(sensors.read(2, value) && near(value, 25.));
+    CHECK(sensors.read(3, value) && near(value, 30.));
+}
+
+int main()
+{
+    auto templ = (fs::temp_directory_path() / "hwmon-XXXXXX").string();
+    if (!::mkdtemp(&templ[0]))
+        return 1;
+
+    const fs::path root(templ);
+    hwmon(root);
+    fs::remove_all(root);
+
+    return check_failures() ? 1 : 0;
+}
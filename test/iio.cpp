@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "check.h"
+#include "iio.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static void write(const fs::path& path, const char* value)
+{
+    fs::create_directories(path.parent_path());
+    ofstream out(path);
+    out << value;
+}
+
+static string read(const fs::path& path)
+{
+    ifstream in(path);
+    string value;
+    getline(in, value);
+    return value;
+}
+
+static bool near(double a, double b)
+{
+    return std::fabs(a - b) < 1e-9;
+}
+
+/// A device with a temperature and a timestamp, as a 16 byte record.
+static void device(const fs::path& sysfs)
+{
+    const auto scan = sysfs / "scan_elements";
+    write(scan / "in_temp_en", "0\n");
+    write(scan / "in_temp_index", "0\n");
+    write(scan / "in_temp_type", "le:s16/16>>0\n");
+    write(scan / "in_timestamp_en", "1\n");
+    write(scan / "in_timestamp_index", "1\n");
+    write(scan / "in_timestamp_type", "le:s64/64>>0\n");
+    write(sysfs / "in_temp_scale", "10\n");
+    write(sysfs / "buffer" / "enable", "0\n");
+}
+
+static array<uint8_t, 16> record(int16_t raw)
+{
+    array<uint8_t, 16> r{};
+    r[0] = static_cast<uint8_t>(raw & 0xff);
+    r[1] = static_cast<uint8_t>((raw >> 8) & 0xff);
+    return r;
+}
+
+static SampleFilter::Config unfiltered()
+{
+    SampleFilter::Config config;
+    config.stuck = std::chrono::seconds(0);
+    config.median = 1;
+    config.alpha = 1.;
+    config.deadband = 0.;
+    return config;
+}
+
+static void scan(const fs::path& sysfs)
+{
+    IioScan::Element element;
+    CHECK(IioScan::parse_type("be:u12/16X2>>4", element));
+    CHECK(element.big_endian && !element.is_signed);
+    CHECK(element.bits == 12 && element.storage == 16 && element.repeat == 2 && element.shift == 4);
+    CHECK(!IioScan::parse_type("le:s16/12>>0", element));
+
+    IioScan decoder;
+    CHECK(decoder.open(sysfs.string()));
+    // opening enables the temperature channel
+    CHECK(read(sysfs / "scan_elements" / "in_temp_en") == "1");
+    CHECK(decoder.record_size() == 16);
+    CHECK(decoder.elements().size() == 2);
+    CHECK(decoder.elements()[1].offset == 8);
+    CHECK(near(decoder.decode(record(2150).data()), 21.5));
+    CHECK(near(decoder.decode(record(-125).data()), -1.25));
+}
+
+/// Scan records written into a FIFO, a record split over two writes.
+static void fifo(const fs::path& sysfs, const fs::path& path)
+{
+    CHECK(::mkfifo(path.c_str(), 0600) == 0);
+
+    asio::io_context io;
+    IioSensor sensor(io);
+    sensor.filter(unfiltered());
+    vector<Sample> samples;
+    sensor.on_sample([&samples](const Sample & sample)
+    {
+        samples.push_back(sample);
+    });
+
+    CHECK(sensor.open(path.string(), sysfs.string()));
+    CHECK(read(sysfs / "buffer" / "enable") == "1");
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    CHECK(fd >= 0);
+
+    auto run = [&io, &samples](size_t count)
+    {
+        while (samples.size() < count && io.run_one_for(std::chrono::seconds(5)))
+        {}
+    };
+
+    auto r = record(2150);
+    CHECK(::write(fd, r.data(), r.size()) == static_cast<ssize_t>(r.size()));
+    run(1);
+    CHECK(samples.size() == 1 && samples[0].q == Sample::quality::good && near(samples[0].value, 21.5));
+
+    r = record(-125);
+    CHECK(::write(fd, r.data(), 5) == 5);
+    io.run_one_for(std::chrono::seconds(5));
+    CHECK(samples.size() == 1);
+    CHECK(::write(fd, r.data() + 5, r.size() - 5) == static_cast<ssize_t>(r.size() - 5));
+    run(2);
+    CHECK(samples.size() == 2 && samples[1].q == Sample::quality::good && near(samples[1].value, -1.25));
+
+    // the end of the FIFO is a fault
+    ::close(fd);
+    run(3);
+    CHECK(samples.size() == 3 && samples[2].q == Sample::quality::fault);
+    CHECK(!sensor.is_open());
+    CHECK(read(sysfs / "buffer" / "enable") == "0");
+}
+
+/// A regular file is read a block at a time, the last record of each passed on.
+static void file(const fs::path& sysfs, const fs::path& path)
+{
+    {
+        ofstream out(path, ios::binary);
+        for (const auto raw : {2000, 2100, 2250})
+        {
+            const auto r = record(static_cast<int16_t>(raw));
+            out.write(reinterpret_cast<const char*>(r.data()), r.size());
+        }
+    }
+
+    asio::io_context io;
+    IioSensor sensor(io);
+    sensor.filter(unfiltered());
+    vector<Sample> samples;
+    sensor.on_sample([&samples](const Sample & sample)
+    {
+        samples.push_back(sample);
+    });
+
+    CHECK(sensor.open(path.string(), sysfs.string()));
+    io.run_for(std::chrono::seconds(5));
+    CHECK(samples.size() == 2);
+    CHECK(samples.size() > 0 && samples[0].q == Sample::quality::good && near(samples[0].value, 22.5));
+    CHECK(samples.size() > 1 && samples[1].q == Sample::quality::fault);
+    CHECK(!sensor.is_open());
+}
+
+int main()
+{
+    auto templ = (fs::temp_directory_path() / "iio-XXXXXX").string();
+    if (!::mkdtemp(&templ[0]))
+        return 1;
+
+    const fs::path root(templ);
+    device(root / "iio:device0");
+    scan(root / "iio:device0");
+    fifo(root / "iio:device0", root / "fifo");
+    file(root / "iio:device0", root / "records");
+    fs::remove_all(root);
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "check.h"
+#include "zones.h"
+
+using namespace std;
+using namespace std::chrono;
+
+using status = ZoneController::status;
+
+struct Fixture
+{
+    Fixture()
+    {
+        zones.clock([this]() { return now; });
+
+        ZoneController::Control control;
+        control.deadband = Temperature::from_celsius(1.);
+        control.heat = {minutes(2), minutes(3)};
+        control.cool = {minutes(3), minutes(5)};
+        control.fan_overrun = minutes(1);
+        zones.control(control);
+
+        zones.on_change([this](const vector<ZoneController::Change>& changes)
+        {
+            for (const auto& change : changes)
+                if (change.fields & ZoneController::dirty::status)
+                    ++transitions;
+        });
+    }
+
+    void at(double celsius)
+    {
+        zones.change_current(0, Temperature::from_celsius(celsius));
+    }
+
+    void wait(seconds s)
+    {
+        now += s;
+        zones.tick();
+    }
+
+    // well past the initial rest times
+    ZoneController::time_point now{hours(1)};
+    ZoneController zones{1, Temperature::from_celsius(20.)};
+    int transitions{0};
+};
+
+/// Stages start and stop half the deadband either side of the target.
+static void hysteresis()
+{
+    Fixture f;
+    f.at(20.);
+    CHECK(f.zones.current_status(0) == status::off);
+    f.at(19.6);
+    CHECK(f.zones.current_status(0) == status::off);
+    f.at(19.4);
+    CHECK(f.zones.current_status(0) == status::heating);
+
+    // noise around the start edge is not a decision
+    for (auto i = 0; i < 10; ++i)
+        f.at(i % 2 ? 19.4 : 19.6);
+    CHECK(f.transitions == 1);
+
+    f.wait(minutes(5));
+    f.at(20.4);
+    CHECK(f.zones.current_status(0) == status::heating);
+    f.at(20.5);
+    CHECK(f.zones.current_status(0) == status::off);
+    CHECK(f.transitions == 2);
+
+    f.wait(minutes(10));
+    f.at(20.6);
+    CHECK(f.zones.current_status(0) == status::cooling);
+}
+
+/// A stage runs for its minimum on time and rests for its minimum off time.
+static void min_on_off()
+{
+    Fixture f;
+    f.at(19.);
+    CHECK(f.zones.current_status(0) == status::heating);
+    const auto started = f.now;
+
+    f.at(20.5);
+    CHECK(f.zones.current_status(0) == status::heating);
+    CHECK(f.zones.deadline() == started + minutes(2));
+    f.wait(seconds(119));
+    CHECK(f.zones.current_status(0) == status::heating);
+    f.wait(seconds(1));
+    CHECK(f.zones.current_status(0) == status::off);
+    const auto stopped = f.now;
+
+    f.wait(minutes(1));
+    f.at(19.);
+    CHECK(f.zones.current_status(0) == status::off);
+    CHECK(f.zones.deadline() == stopped + minutes(3));
+    f.wait(seconds(119));
+    CHECK(f.zones.current_status(0) == status::off);
+    f.wait(seconds(1));
+    CHECK(f.zones.current_status(0) == status::heating);
+
+    // turning the zone off does not wait for the minimum on time
+    f.zones.set_mode(0, ZoneController::mode::off);
+    CHECK(f.zones.current_status(0) == status::off);
+}
+
+/// The fan keeps running for the overrun after a stage stops.
+static void fan_overrun()
+{
+    Fixture f;
+    f.at(19.);
+    CHECK(f.zones.current_fan_status(0));
+
+    f.wait(minutes(2));
+    f.at(20.5);
+    CHECK(f.zones.current_status(0) == status::off);
+    CHECK(f.zones.current_fan_status(0));
+    CHECK(f.zones.deadline() == f.now + minutes(1));
+
+    f.wait(seconds(59));
+    CHECK(f.zones.current_fan_status(0));
+    f.wait(seconds(1));
+    CHECK(!f.zones.current_fan_status(0));
+
+    f.zones.set_fan_mode(0, ZoneController::fanmode::on);
+    CHECK(f.zones.current_fan_status(0));
+}
+
+/// Without a temperature to go on a zone stops, once past its minimum on time.
+static void lost_current()
+{
+    Fixture f;
+    f.zones.tick();
+    CHECK(f.zones.current_status(0) == status::off);
+
+    f.at(19.);
+    CHECK(f.zones.current_status(0) == status::heating);
+    f.zones.lose_current(0);
+    CHECK(f.zones.current_status(0) == status::heating);
+    f.wait(minutes(2));
+    CHECK(f.zones.current_status(0) == status::off);
+}
+
+int main()
+{
+    hysteresis();
+    min_on_off();
+    fan_overrun();
+    lost_current();
+    return check_failures() ? 1 : 0;
+}
@@ -1,4 +1,5 @@
 BEGIN TRANSACTION;
+PRAGMA user_version = 1;
 CREATE TABLE IF NOT EXISTS "temp_log" (
 	`id`	INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT UNIQUE,
 	`sensor`	TEXT,
@@ -7,10 +8,45 @@ CREATE TABLE IF NOT EXISTS "temp_log" (
 );
 CREATE TABLE IF NOT EXISTS `status_log` (
 	`id`	INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT UNIQUE,
+	`zone`	INTEGER NOT NULL DEFAULT 0,
 	`status`	INTEGER NOT NULL,
 	`fan`	INTEGER NOT NULL,
 	`datetime`	INTEGER NOT NULL
 );
+CREATE INDEX IF NOT EXISTS temp_log_datetime ON temp_log (datetime);
+CREATE INDEX IF NOT EXISTS status_log_datetime ON status_log (datetime);
+CREATE TABLE IF NOT EXISTS `log_rollup` (
+	`id`	INTEGER NOT NULL PRIMARY KEY,
+	`upto`	INTEGER NOT NULL,
+	`status`	INTEGER NOT NULL
+);
+CREATE TABLE IF NOT EXISTS `log_minute` (
+	`datetime`	INTEGER NOT NULL PRIMARY KEY,
+	`samples`	INTEGER NOT NULL,
+	`temp_min`	REAL,
+	`temp_max`	REAL,
+	`temp_mean`	REAL,
+	`heat`	REAL NOT NULL,
+	`cool`	REAL NOT NULL
+);
+CREATE TABLE IF NOT EXISTS `log_hour` (
+	`datetime`	INTEGER NOT NULL PRIMARY KEY,
+	`samples`	INTEGER NOT NULL,
+	`temp_min`	REAL,
+	`temp_max`	REAL,
+	`temp_mean`	REAL,
+	`heat`	REAL NOT NULL,
+	`cool`	REAL NOT NULL
+);
+CREATE TABLE IF NOT EXISTS `log_day` (
+	`datetime`	INTEGER NOT NULL PRIMARY KEY,
+	`samples`	INTEGER NOT NULL,
+	`temp_min`	REAL,
+	`temp_max`	REAL,
+	`temp_mean`	REAL,
+	`heat`	REAL NOT NULL,
+	`cool`	REAL NOT NULL
+);
 CREATE TABLE IF NOT EXISTS `schedule` (
 	`id`	INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT UNIQUE,
 	`dow`	INTEGER,